@@ -0,0 +1,55 @@
+#include "backend.h"
+#include "mirror.h"
+
+#include <string.h>
+
+
+static uint32_t interpreter_run(struct chip8_state* state, uint32_t instructions, int until_branch)
+{
+  state->fault = CHIP8_FAULT_NONE;
+  for (uint32_t i = 0; i < instructions; ++i)
+  {
+    uint16_t next = state->pc + 2;
+    chip8_cycle(state);
+    if (state->fault != CHIP8_FAULT_NONE || (until_branch && state->pc != next))
+    {
+      return i + 1;
+    }
+  }
+  return instructions;
+}
+
+// The interpreter on a state with mirrored memory, no address is masked.
+static uint32_t mirrored_run(struct chip8_state* state, uint32_t instructions, int until_branch)
+{
+  state->fault = CHIP8_FAULT_NONE;
+  for (uint32_t i = 0; i < instructions; ++i)
+  {
+    uint16_t next = state->pc + 2;
+    chip8_cycle_mirrored(state);
+    if (state->fault != CHIP8_FAULT_NONE || (until_branch && state->pc != next))
+    {
+      return i + 1;
+    }
+  }
+  return instructions;
+}
+
+const struct chip8_backend chip8_backends[] = {
+  { "interpreter", interpreter_run, new_chip8, delete_chip8 },
+  { "mirrored", mirrored_run, new_chip8_mirrored, delete_chip8_mirrored },
+};
+
+const int chip8_backend_count = sizeof(chip8_backends) / sizeof(chip8_backends[0]);
+
+const struct chip8_backend* find_backend(const char* name)
+{
+  for (int i = 0; i < chip8_backend_count; ++i)
+  {
+    if (strcmp(chip8_backends[i].name, name) == 0)
+    {
+      return &chip8_backends[i];
+    }
+  }
+  return NULL;
+}
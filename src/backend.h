@@ -0,0 +1,26 @@
+#ifndef BACKEND_H
+#define BACKEND_H
+
+#include <stdint.h>
+#include "chip8.h"
+
+// An execution engine. run executes up to instructions instructions, stopping
+// early after the first one that does not fall through to pc + 2 when
+// until_branch is set, or after the first one that faults, and returns how
+// many ran. It clears the state's fault first, like chip8_run_frames.
+// run only takes states from new_state, which returns NULL when the backend
+// is not available here.
+struct chip8_backend
+{
+  const char* name;
+  uint32_t (*run)(struct chip8_state* state, uint32_t instructions, int until_branch);
+  struct chip8_state* (*new_state)();
+  void (*delete_state)(struct chip8_state* state);
+};
+
+extern const struct chip8_backend chip8_backends[];
+extern const int chip8_backend_count;
+
+const struct chip8_backend* find_backend(const char* name);
+
+#endif
@@ -0,0 +1,302 @@
+#include "capture.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Two colours, so codes start at 3 bits after the clear and end codes.
+#define GIF_MIN_CODE_SIZE 2
+#define GIF_CLEAR (1 << GIF_MIN_CODE_SIZE)
+#define GIF_END (GIF_CLEAR + 1)
+#define GIF_MAX_CODES 4096
+
+// Bits go out least significant first, in sub-blocks of up to 255 bytes.
+struct bit_writer
+{
+  FILE* file;
+  uint8_t block[255];
+  int length;
+  uint32_t bits;
+  int count;
+};
+
+static void put_code(struct bit_writer* writer, uint32_t code, int size)
+{
+  writer->bits |= code << writer->count;
+  writer->count += size;
+  while (writer->count >= 8)
+  {
+    writer->block[writer->length++] = writer->bits & 0xFF;
+    writer->bits >>= 8;
+    writer->count -= 8;
+    if (writer->length == 255)
+    {
+      fputc(255, writer->file);
+      fwrite(writer->block, 1, 255, writer->file);
+      writer->length = 0;
+    }
+  }
+}
+
+static void flush_codes(struct bit_writer* writer)
+{
+  if (writer->count > 0)
+  {
+    put_code(writer, 0, 8 - writer->count);
+  }
+  if (writer->length > 0)
+  {
+    fputc(writer->length, writer->file);
+    fwrite(writer->block, 1, writer->length, writer->file);
+  }
+  fputc(0, writer->file);
+}
+
+// The dictionary is a trie over the two pixel values, children[code][pixel]
+// is the code for that string plus one more pixel, 0 when there is none.
+static void compress(struct capture* capture, const uint8_t* pixels, uint32_t count)
+{
+  struct bit_writer writer = { capture->file };
+  fputc(GIF_MIN_CODE_SIZE, capture->file);
+
+  memset(capture->children, 0, GIF_MAX_CODES * sizeof(capture->children[0]));
+  int size = GIF_MIN_CODE_SIZE + 1;
+  uint32_t next = GIF_END + 1;
+  put_code(&writer, GIF_CLEAR, size);
+
+  uint32_t prefix = pixels[0];
+  for (uint32_t i = 1; i < count; ++i)
+  {
+    uint8_t pixel = pixels[i];
+    if (capture->children[prefix][pixel] != 0)
+    {
+      prefix = capture->children[prefix][pixel];
+      continue;
+    }
+
+    put_code(&writer, prefix, size);
+    if (next < GIF_MAX_CODES)
+    {
+      if (next == 1u << size)
+      {
+        size += 1;
+      }
+      capture->children[prefix][pixel] = next++;
+    }
+    else
+    {
+      put_code(&writer, GIF_CLEAR, size);
+      memset(capture->children, 0, GIF_MAX_CODES * sizeof(capture->children[0]));
+      size = GIF_MIN_CODE_SIZE + 1;
+      next = GIF_END + 1;
+    }
+    prefix = pixel;
+  }
+
+  // The decoder adds an entry for the last code too and may widen before
+  // it reads the end code.
+  put_code(&writer, prefix, size);
+  if (next < GIF_MAX_CODES && next == 1u << size)
+  {
+    size += 1;
+  }
+  put_code(&writer, GIF_END, size);
+  flush_codes(&writer);
+}
+
+static void put_short(FILE* file, uint32_t value)
+{
+  fputc(value & 0xFF, file);
+  fputc(value >> 8 & 0xFF, file);
+}
+
+static int pixel(const uint8_t* packed, int x, int y)
+{
+  return packed[y * 8 + x / 8] >> (x % 8) & 1;
+}
+
+// Hundredths of a second, rounded from the start so short frames do not
+// add up to drift.
+static uint32_t centiseconds(uint64_t tick)
+{
+  return (tick * 100 + CAPTURE_TICKS_PER_SECOND / 2) / CAPTURE_TICKS_PER_SECOND;
+}
+
+static void write_frame(struct capture* capture, const uint8_t* packed, uint32_t delay)
+{
+  // Bounds of the pixels that differ from the frame before, all of the
+  // first frame.
+  int left = CHIP8_SCREEN_WIDTH, right = -1, top = CHIP8_SCREEN_HEIGHT, bottom = -1;
+  for (int y = 0; y < CHIP8_SCREEN_HEIGHT; ++y)
+  {
+    for (int x = 0; x < CHIP8_SCREEN_WIDTH; ++x)
+    {
+      if (capture->frames == 0 || pixel(packed, x, y) != pixel(capture->written, x, y))
+      {
+        left = x < left ? x : left;
+        right = x > right ? x : right;
+        top = y < top ? y : top;
+        bottom = y > bottom ? y : bottom;
+      }
+    }
+  }
+  if (right < 0)
+  {
+    left = right = top = bottom = 0;
+  }
+
+  // Graphic control: keep the previous frame under this one, delay.
+  FILE* file = capture->file;
+  fputc(0x21, file);
+  fputc(0xF9, file);
+  fputc(4, file);
+  fputc(0x04, file);
+  put_short(file, delay < 0xFFFF ? delay : 0xFFFF);
+  fputc(0, file);
+  fputc(0, file);
+
+  uint32_t scale = capture->scale;
+  uint32_t width = (right - left + 1) * scale;
+  uint32_t height = (bottom - top + 1) * scale;
+  fputc(0x2C, file);
+  put_short(file, left * scale);
+  put_short(file, top * scale);
+  put_short(file, width);
+  put_short(file, height);
+  fputc(0, file);
+
+  uint8_t* out = capture->pixels;
+  for (uint32_t y = 0; y < height; ++y)
+  {
+    for (uint32_t x = 0; x < width; ++x)
+    {
+      *out++ = pixel(packed, left + x / scale, top + y / scale);
+    }
+  }
+  compress(capture, capture->pixels, width * height);
+
+  memcpy(capture->written, packed, CHIP8_PACKED_DISPLAY_SIZE);
+  capture->frames += 1;
+}
+
+static void encode_entry(struct capture* capture, struct capture_entry* entry)
+{
+  if (capture->has_pending)
+  {
+    write_frame(capture, capture->pending.display, centiseconds(entry->tick) - centiseconds(capture->pending.tick));
+  }
+  capture->pending = *entry;
+  capture->has_pending = 1;
+}
+
+static int encode(void* argument)
+{
+  struct capture* capture = argument;
+  for (;;)
+  {
+    uint32_t tail = atomic_load_explicit(&capture->tail, memory_order_relaxed);
+    if (tail == atomic_load_explicit(&capture->head, memory_order_acquire))
+    {
+      if (atomic_load_explicit(&capture->closing, memory_order_acquire))
+      {
+        // Anything queued before closing is visible by now.
+        if (tail == atomic_load_explicit(&capture->head, memory_order_acquire))
+        {
+          break;
+        }
+        continue;
+      }
+      thrd_sleep(&(struct timespec){ .tv_nsec = 1000000 }, NULL);
+      continue;
+    }
+
+    encode_entry(capture, &capture->entries[tail % CAPTURE_QUEUE_SIZE]);
+    atomic_store_explicit(&capture->tail, tail + 1, memory_order_release);
+  }
+
+  if (capture->has_pending)
+  {
+    uint64_t end = capture->end_tick > capture->pending.tick ? capture->end_tick : capture->pending.tick + 1;
+    write_frame(capture, capture->pending.display, centiseconds(end) - centiseconds(capture->pending.tick));
+  }
+  return 0;
+}
+
+struct capture* new_capture(const char* path, uint32_t scale)
+{
+  FILE* file = fopen(path, "wb");
+  if (file == NULL)
+  {
+    perror("Error");
+    return NULL;
+  }
+
+  struct capture* capture = aligned_alloc(64, sizeof(struct capture));
+  memset(capture, 0, sizeof(struct capture));
+  capture->file = file;
+  capture->scale = scale;
+  capture->pixels = malloc(CHIP8_SCREEN_WIDTH * CHIP8_SCREEN_HEIGHT * scale * scale);
+  capture->children = malloc(GIF_MAX_CODES * sizeof(capture->children[0]));
+  atomic_init(&capture->head, 0);
+  atomic_init(&capture->tail, 0);
+  atomic_init(&capture->closing, 0);
+
+  // Screen with a black and white palette, looping forever.
+  fwrite("GIF89a", 1, 6, file);
+  put_short(file, CHIP8_SCREEN_WIDTH * scale);
+  put_short(file, CHIP8_SCREEN_HEIGHT * scale);
+  fputc(0x80, file);
+  fputc(0, file);
+  fputc(0, file);
+  const uint8_t palette[6] = { 0, 0, 0, 255, 255, 255 };
+  fwrite(palette, 1, sizeof(palette), file);
+  fwrite("\x21\xFF\x0BNETSCAPE2.0\x03\x01\x00\x00\x00", 1, 19, file);
+
+  thrd_create(&capture->encoder, encode, capture);
+  return capture;
+}
+
+int capture_frame(struct capture* capture, const uint8_t* packed, uint64_t tick, int block)
+{
+  if (capture->submitted != 0 && memcmp(packed, capture->queued, CHIP8_PACKED_DISPLAY_SIZE) == 0)
+  {
+    return 1;
+  }
+
+  uint32_t head = atomic_load_explicit(&capture->head, memory_order_relaxed);
+  while (head - atomic_load_explicit(&capture->tail, memory_order_acquire) == CAPTURE_QUEUE_SIZE)
+  {
+    if (!block)
+    {
+      capture->dropped += 1;
+      return 0;
+    }
+    thrd_yield();
+  }
+
+  struct capture_entry* entry = &capture->entries[head % CAPTURE_QUEUE_SIZE];
+  memcpy(entry->display, packed, CHIP8_PACKED_DISPLAY_SIZE);
+  entry->tick = tick;
+  atomic_store_explicit(&capture->head, head + 1, memory_order_release);
+
+  memcpy(capture->queued, packed, CHIP8_PACKED_DISPLAY_SIZE);
+  capture->submitted += 1;
+  return 1;
+}
+
+void finish_capture(struct capture* capture, uint64_t end_tick)
+{
+  capture->end_tick = end_tick;
+  atomic_store_explicit(&capture->closing, 1, memory_order_release);
+  thrd_join(capture->encoder, NULL);
+
+  fputc(0x3B, capture->file);
+  capture->bytes = ftell(capture->file);
+  fclose(capture->file);
+}
+
+void delete_capture(struct capture* capture)
+{
+  free(capture->children);
+  free(capture->pixels);
+  free(capture);
+}
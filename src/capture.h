@@ -0,0 +1,68 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <threads.h>
+#include "chip8.h"
+
+// Records the display as an animated GIF. The emulation thread hands
+// displays to an encoder thread through a bounded single producer, single
+// consumer queue. A display equal to the previous one is never queued, it
+// only makes the previous frame last longer, and every frame stores just
+// the rectangle that changed.
+
+#define CAPTURE_QUEUE_SIZE 64
+#define CAPTURE_TICKS_PER_SECOND 60
+
+struct capture_entry
+{
+  uint8_t display[CHIP8_PACKED_DISPLAY_SIZE];
+  // Timer ticks since recording started
+  uint64_t tick;
+};
+
+struct capture
+{
+  FILE* file;
+  uint32_t scale;
+  thrd_t encoder;
+
+  struct capture_entry entries[CAPTURE_QUEUE_SIZE];
+  _Alignas(64) _Atomic uint32_t head;
+  _Alignas(64) _Atomic uint32_t tail;
+  _Atomic int closing;
+  uint64_t end_tick;
+
+  // Producer side, the display last queued.
+  uint8_t queued[CHIP8_PACKED_DISPLAY_SIZE];
+  uint64_t submitted;
+  uint64_t dropped;
+
+  // Encoder side, a frame is written once the next one gives its duration.
+  uint8_t written[CHIP8_PACKED_DISPLAY_SIZE];
+  struct capture_entry pending;
+  int has_pending;
+  uint8_t* pixels;
+  uint16_t (*children)[2];
+  uint64_t frames;
+  // File size, set by finish_capture
+  uint64_t bytes;
+};
+
+// scale is the GIF pixels per CHIP-8 pixel. NULL when the file cannot be
+// created.
+struct capture* new_capture(const char* path, uint32_t scale);
+
+// Producer side. Queues display unless it equals the one queued last.
+// Returns 0 when the queue was full and the display was dropped, with
+// block set it waits for room instead.
+int capture_frame(struct capture* capture, const uint8_t* packed, uint64_t tick, int block);
+
+// Encodes what is queued, the last frame lasting until end_tick, and
+// closes the file. frames and bytes are final afterwards.
+void finish_capture(struct capture* capture, uint64_t end_tick);
+void delete_capture(struct capture* capture);
+
+#endif
@@ -3,59 +3,60 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-
-
-struct chip8_state* new_chip8()
+#include <time.h>
+
+
+static const uint8_t fontset[] = {
+  0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
+  0x20, 0x60, 0x20, 0x20, 0x70, // 1
+  0xF0, 0x10, 0xF0, 0x80, 0xF0, // 2
+  0xF0, 0x10, 0xF0, 0x10, 0xF0, // 3
+  0x90, 0x90, 0xF0, 0x10, 0x10, // 4
+  0xF0, 0x80, 0xF0, 0x10, 0xF0, // 5
+  0xF0, 0x80, 0xF0, 0x90, 0xF0, // 6
+  0xF0, 0x10, 0x20, 0x40, 0x40, // 7
+  0xF0, 0x90, 0xF0, 0x90, 0xF0, // 8
+  0xF0, 0x90, 0xF0, 0x10, 0xF0, // 9
+  0xF0, 0x90, 0xF0, 0x90, 0x90, // A
+  0xE0, 0x90, 0xE0, 0x90, 0xE0, // B
+  0xF0, 0x80, 0x80, 0x80, 0xF0, // C
+  0xE0, 0x90, 0x90, 0x90, 0xE0, // D
+  0xF0, 0x80, 0xF0, 0x80, 0xF0, // E
+  0xF0, 0x80, 0xF0, 0x80, 0x80  // F
+};
+
+void chip8_init(struct chip8_state* state)
 {
-  struct chip8_state* state = malloc(sizeof(struct chip8_state));
-
-  state->I = 0;
+  memset(state, 0, sizeof(struct chip8_state));
   state->pc = 0x200;
-  state->sp = 0;
-  state->delay_timer = 0;
-  state->sound_timer = 0;
-  state->draw_flag = 0;
-
-  for (int i = 0; i < 0xF; ++i)
-  {
-    state->V[i] = 0;
-    state->input[i] = 0;
-    state->waiting_input[i] = 0;
-  }
-
-  for (int i = 0; i < CHIP8_SCREEN_WIDTH * CHIP8_SCREEN_HEIGHT; ++i)
-  {
-    state->display[i] = 0;
-  }
 
   // Load fontset
-  uint8_t fontset[] = {
-    0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
-    0x20, 0x60, 0x20, 0x20, 0x70, // 1
-    0xF0, 0x10, 0xF0, 0x80, 0xF0, // 2
-    0xF0, 0x10, 0xF0, 0x10, 0xF0, // 3
-    0x90, 0x90, 0xF0, 0x10, 0x10, // 4
-    0xF0, 0x80, 0xF0, 0x10, 0xF0, // 5
-    0xF0, 0x80, 0xF0, 0x90, 0xF0, // 6
-    0xF0, 0x10, 0x20, 0x40, 0x40, // 7
-    0xF0, 0x90, 0xF0, 0x90, 0xF0, // 8
-    0xF0, 0x90, 0xF0, 0x10, 0xF0, // 9
-    0xF0, 0x90, 0xF0, 0x90, 0x90, // A
-    0xE0, 0x90, 0xE0, 0x90, 0xE0, // B
-    0xF0, 0x80, 0x80, 0x80, 0xF0, // C
-    0xE0, 0x90, 0x90, 0x90, 0xE0, // D
-    0xF0, 0x80, 0xF0, 0x80, 0xF0, // E
-    0xF0, 0x80, 0xF0, 0x80, 0x80  // F
-  };
-
   memcpy(state->memory, fontset, sizeof(fontset));
 
   time_t t;
-  srand((unsigned) time(&t));
+  chip8_seed(state, (uint32_t) time(&t));
+}
 
+struct chip8_state* new_chip8()
+{
+  struct chip8_state* state = aligned_alloc(64, sizeof(struct chip8_state));
+  chip8_init(state);
   return state;
 }
 
+void chip8_own_memory(struct chip8_state* state)
+{
+  for (int page = 0; page < 16; ++page)
+  {
+    if (state->shared_pages >> page & 1)
+    {
+      memcpy(&state->memory[page * CHIP8_PAGE_SIZE], &state->shared_memory[page * CHIP8_PAGE_SIZE], CHIP8_PAGE_SIZE);
+    }
+  }
+  state->shared_pages = 0;
+  state->shared_memory = NULL;
+}
+
 void load_program(struct chip8_state* state, char* program_path)
 {
   FILE* file = fopen(program_path, "rb");
@@ -64,9 +65,10 @@ void load_program(struct chip8_state* state, char* program_path)
     perror("Error");
     return;
   }
+  chip8_own_memory(state);
   int i = 0x200;
   unsigned char c;
-  while (1)
+  while (i < sizeof(state->memory))
   {
     c = fgetc(file);
     if (feof(file))
@@ -76,6 +78,7 @@ void load_program(struct chip8_state* state, char* program_path)
     state->memory[i] = c;
     i += 1;
   }
+  fclose(file);
 }
 
 void delete_chip8(struct chip8_state* state)
@@ -83,9 +86,173 @@ void delete_chip8(struct chip8_state* state)
   free(state);
 }
 
-void chip8_cycle(struct chip8_state* state)
+// Each instance has its own generator so runs can be reproduced.
+void chip8_seed(struct chip8_state* state, uint32_t seed)
+{
+  state->rng = seed != 0 ? seed : 0x2545F491;
+}
+
+// Bit i of keys is key i.
+void chip8_set_keys(struct chip8_state* state, uint16_t keys)
+{
+  for (int i = 0; i < 16; ++i)
+  {
+    state->input[i] = (keys >> i) & 1;
+  }
+}
+
+static uint8_t chip8_random(struct chip8_state* state)
+{
+  // xorshift32
+  uint32_t x = state->rng;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  state->rng = x;
+  return x >> 24;
+}
+
+void chip8_timer_tick(struct chip8_state* state)
+{
+  if (state->sound_timer > 0)
+  {
+    state->sound_timer -= 1;
+  }
+
+  if (state->delay_timer > 0)
+  {
+    state->delay_timer -= 1;
+  }
+}
+
+void chip8_pack_display(struct chip8_state* state, uint8_t* packed)
+{
+  // Pixels are 0 or 1, the multiply gathers the low bit of each of the eight
+  // bytes into the top byte.
+  for (int i = 0; i < CHIP8_PACKED_DISPLAY_SIZE; ++i)
+  {
+    uint64_t pixels;
+    memcpy(&pixels, &state->display[i * 8], sizeof(pixels));
+    packed[i] = (pixels * 0x0102040810204080ull) >> 56;
+  }
+}
+
+uint32_t chip8_pack_rows(struct chip8_state* state, uint8_t* packed, uint32_t rows)
+{
+  uint32_t changed = 0;
+  for (; rows != 0; rows &= rows - 1)
+  {
+    int y = __builtin_ctz(rows);
+    uint64_t row = 0;
+    for (int i = 0; i < CHIP8_SCREEN_WIDTH / 8; ++i)
+    {
+      uint64_t pixels;
+      memcpy(&pixels, &state->display[y * CHIP8_SCREEN_WIDTH + i * 8], sizeof(pixels));
+      row |= ((pixels * 0x0102040810204080ull) >> 56) << (i * 8);
+    }
+
+    uint64_t before;
+    memcpy(&before, &packed[y * 8], sizeof(before));
+    if (row != before)
+    {
+      memcpy(&packed[y * 8], &row, sizeof(row));
+      changed |= 1u << y;
+    }
+  }
+  return changed;
+}
+
+// The only pointer in the state is to shared memory, which never changes,
+// so a snapshot is a plain copy.
+void chip8_snapshot(struct chip8_state* state, struct chip8_state* snapshot)
+{
+  memcpy(snapshot, state, sizeof(struct chip8_state));
+}
+
+void chip8_restore(struct chip8_state* state, struct chip8_state* snapshot)
+{
+  memcpy(state, snapshot, sizeof(struct chip8_state));
+}
+
+// Takes a private copy of a shared page before its first write.
+static void chip8_write(struct chip8_state* state, uint16_t address, uint8_t value)
+{
+  uint16_t page = address >> 8 & 0x0F;
+  if (state->shared_pages >> page & 1)
+  {
+    memcpy(&state->memory[page * CHIP8_PAGE_SIZE], &state->shared_memory[page * CHIP8_PAGE_SIZE], CHIP8_PAGE_SIZE);
+    state->shared_pages &= ~(1u << page);
+  }
+  state->memory[address] = value;
+}
+
+#ifdef __GNUC__
+#define CHIP8_ALWAYS_INLINE inline __attribute__((always_inline))
+#else
+#define CHIP8_ALWAYS_INLINE inline
+#endif
+
+// How cycle reaches guest memory. Guest addresses wrap at 4 KB and every
+// access that wraps is reported as a fault, which compares the address and
+// does not need the wrapped one. The checked cycle looks up shared pages. A
+// mirrored state has its memory mapped again after itself, far enough for
+// any address an instruction can form, so it skips the wrap and the shared
+// page check. The masked cycle only skips the shared page check, it is there
+// to measure what the mirrors save.
+#define CYCLE_CHECKED 0
+#define CYCLE_MASKED 1
+#define CYCLE_MIRRORED 2
+
+static CHIP8_ALWAYS_INLINE uint8_t load(struct chip8_state* state, uint32_t address, int access)
+{
+  switch (access)
+  {
+    case CYCLE_CHECKED:
+      return chip8_read(state, address & 0x0FFF);
+    case CYCLE_MASKED:
+      return state->memory[address & 0x0FFF];
+    default:
+      return state->memory[address];
+  }
+}
+
+static CHIP8_ALWAYS_INLINE void store(struct chip8_state* state, uint32_t address, uint8_t value, int access)
+{
+  switch (access)
+  {
+    case CYCLE_CHECKED:
+      chip8_write(state, address & 0x0FFF, value);
+      break;
+    case CYCLE_MASKED:
+      state->memory[address & 0x0FFF] = value;
+      break;
+    default:
+      state->memory[address] = value;
+      break;
+  }
+}
+
+// Out of the way of the instructions, nothing here is printed, frontends
+// read the fault from the state when it suits them.
+#ifdef __GNUC__
+__attribute__((cold, noinline))
+#endif
+static void trap(struct chip8_state* state, uint8_t fault, uint16_t pc, uint16_t opcode)
+{
+  state->fault = fault;
+  state->fault_pc = pc;
+  state->fault_opcode = opcode;
+  state->fault_counts[fault - 1] += 1;
+}
+
+static CHIP8_ALWAYS_INLINE void cycle(struct chip8_state* state, int access)
 {
-  uint16_t opcode = state->memory[state->pc] << 8 | state->memory[state->pc + 1];
+  uint16_t pc = state->pc;
+  uint16_t opcode = load(state, pc, access) << 8 | load(state, pc + 1, access);
+  if (pc > 0x0FFE)
+  {
+    trap(state, CHIP8_FAULT_MEMORY, pc, opcode);
+  }
   //printf("OPCODE: %04X PC: %04X\n", opcode, state->pc);
   state->pc += 2;
 
@@ -101,17 +268,23 @@ void chip8_cycle(struct chip8_state* state)
           {
             state->display[i] = 0;
           }
+          state->dirty_rows = 0xFFFFFFFF;
           state->draw_flag = 1;
           break;
         
         // 0x00EE RET - Return from a subroutine.
         case 0x00EE:
+          if (state->sp == 0)
+          {
+            trap(state, CHIP8_FAULT_STACK_UNDERFLOW, pc, opcode);
+            break;
+          }
           state->sp -= 1;
           state->pc = state->stack[state->sp];
           break;
         
         default:
-          printf("(ERROR) Unknown opcode: 0x%4X\n", opcode);
+          trap(state, CHIP8_FAULT_UNKNOWN_OPCODE, pc, opcode);
           break;
       }
       break;
@@ -123,6 +296,11 @@ void chip8_cycle(struct chip8_state* state)
 
     // 0x2nnn CALL addr - Call subroutine at nnn.
     case 0x2000:
+      if (state->sp >= sizeof(state->stack) / sizeof(state->stack[0]))
+      {
+        trap(state, CHIP8_FAULT_STACK_OVERFLOW, pc, opcode);
+        break;
+      }
       state->stack[state->sp] = state->pc;
       state->sp += 1;
       state->pc = opcode & 0x0FFF;
@@ -253,7 +431,7 @@ void chip8_cycle(struct chip8_state* state)
           break;
 
         default:
-          printf("(ERROR) Unknown opcode: 0x%4X\n", opcode);
+          trap(state, CHIP8_FAULT_UNKNOWN_OPCODE, pc, opcode);
       }
       break;
     }
@@ -284,7 +462,7 @@ void chip8_cycle(struct chip8_state* state)
     case 0xC000:
     {
       uint8_t x = (opcode & 0x0F00) >> 8;
-      state->V[x] = (rand() % 256) & (opcode & 0x00FF);
+      state->V[x] = chip8_random(state) & (opcode & 0x00FF);
       break;
     }
 
@@ -293,22 +471,31 @@ void chip8_cycle(struct chip8_state* state)
     {
       uint8_t x = (opcode & 0x0F00) >> 8;
       uint8_t y = (opcode & 0x00F0) >> 4;
+      if (state->I + (opcode & 0x000F) > 0x1000)
+      {
+        trap(state, CHIP8_FAULT_MEMORY, pc, opcode);
+      }
+      // The sprite starts at Vx, Vy wrapped onto the screen, whatever
+      // reaches past the right or bottom edge is clipped.
+      uint8_t left = state->V[x] % CHIP8_SCREEN_WIDTH;
+      uint8_t top = state->V[y] % CHIP8_SCREEN_HEIGHT;
+      int rows = (opcode & 0x000F) < CHIP8_SCREEN_HEIGHT - top ? (opcode & 0x000F) : CHIP8_SCREEN_HEIGHT - top;
+      int columns = 8 < CHIP8_SCREEN_WIDTH - left ? 8 : CHIP8_SCREEN_WIDTH - left;
       state->V[0xF] = 0;
-      for (int i = 0; i < (opcode & 0x000F); ++i)
+      for (int i = 0; i < rows; ++i)
       {
-        for (int j = 0; j < 8; ++j)
+        // An empty sprite row XORs nothing.
+        uint8_t sprite = load(state, state->I + i, access);
+        if (sprite != 0)
         {
-          int screen_x = state->V[x] + j;
-          int screen_y = state->V[y] + i;
-
-          screen_x %= 64;
-          screen_y %= 32;
-
-          uint8_t sprite_mask = 1 << (7 - j);
-          uint8_t sprite_value = (state->memory[state->I + i] & sprite_mask) >> (7 - j);
-
-          state->V[0xF] |= sprite_value & state->display[screen_y * 64 + screen_x];
-          state->display[screen_y * 64 + screen_x] ^= sprite_value;
+          state->dirty_rows |= 1u << (top + i);
+        }
+        uint8_t* pixels = &state->display[(top + i) * CHIP8_SCREEN_WIDTH + left];
+        for (int j = 0; j < columns; ++j)
+        {
+          uint8_t sprite_value = (sprite >> (7 - j)) & 1;
+          state->V[0xF] |= sprite_value & pixels[j];
+          pixels[j] ^= sprite_value;
         }
       }
       state->draw_flag = 1;
@@ -322,7 +509,11 @@ void chip8_cycle(struct chip8_state* state)
         case 0x000E:
         {
           uint8_t x = (opcode & 0x0F00) >> 8;
-          state->pc += state->input[state->V[x]] * 2;
+          if (state->V[x] > 0x0F)
+          {
+            trap(state, CHIP8_FAULT_MEMORY, pc, opcode);
+          }
+          state->pc += state->input[state->V[x] & 0x0F] * 2;
           break;
         }
 
@@ -330,12 +521,16 @@ void chip8_cycle(struct chip8_state* state)
         case 0x0001:
         {
           uint8_t x = (opcode & 0x0F00) >> 8;
-          state->pc += (1 - state->input[state->V[x]]) * 2;
+          if (state->V[x] > 0x0F)
+          {
+            trap(state, CHIP8_FAULT_MEMORY, pc, opcode);
+          }
+          state->pc += (1 - state->input[state->V[x] & 0x0F]) * 2;
           break;
         }
 
         default:
-          printf("(ERROR) Unknown opcode: 0x%4X\n", opcode);
+          trap(state, CHIP8_FAULT_UNKNOWN_OPCODE, pc, opcode);
       }
       break;
 
@@ -407,9 +602,13 @@ void chip8_cycle(struct chip8_state* state)
         case 0x0033:
         {
           uint8_t x = (opcode & 0x0F00) >> 8;
-          state->memory[state->I] = state->V[x] / 100;
-          state->memory[state->I + 1] = (state->V[x] / 10) % 10;
-          state->memory[state->I + 2] = state->V[x] % 10;
+          if (state->I + 2 > 0x0FFF)
+          {
+            trap(state, CHIP8_FAULT_MEMORY, pc, opcode);
+          }
+          store(state, state->I, state->V[x] / 100, access);
+          store(state, state->I + 1, (state->V[x] / 10) % 10, access);
+          store(state, state->I + 2, state->V[x] % 10, access);
           break;
         }
 
@@ -417,9 +616,13 @@ void chip8_cycle(struct chip8_state* state)
         case 0x0055:
         {
           uint8_t x = (opcode & 0x0F00) >> 8;
+          if (state->I + x > 0x0FFF)
+          {
+            trap(state, CHIP8_FAULT_MEMORY, pc, opcode);
+          }
           for (int i = 0; i <= x; ++i)
           {
-            state->memory[state->I + i] = state->V[i];
+            store(state, state->I + i, state->V[i], access);
           }
           break;
         }
@@ -428,20 +631,88 @@ void chip8_cycle(struct chip8_state* state)
         case 0x0065:
         {
           uint8_t x = (opcode & 0x0F00) >> 8;
+          if (state->I + x > 0x0FFF)
+          {
+            trap(state, CHIP8_FAULT_MEMORY, pc, opcode);
+          }
           for (int i = 0; i <= x; ++i)
           {
-            state->V[i] = state->memory[state->I + i];
+            state->V[i] = load(state, state->I + i, access);
           }
           break;
         }
 
         default:
-          printf("(ERROR) Unknown opcode: 0x%4X\n", opcode);
+          trap(state, CHIP8_FAULT_UNKNOWN_OPCODE, pc, opcode);
       }
       break;
 
     default:
-      printf("(ERROR) Unknown opcode: 0x%4X\n", opcode);
+      trap(state, CHIP8_FAULT_UNKNOWN_OPCODE, pc, opcode);
       break;
   }
 }
+
+void chip8_cycle(struct chip8_state* state)
+{
+  cycle(state, CYCLE_CHECKED);
+}
+
+void chip8_cycle_masked(struct chip8_state* state)
+{
+  cycle(state, CYCLE_MASKED);
+}
+
+void chip8_cycle_mirrored(struct chip8_state* state)
+{
+  cycle(state, CYCLE_MIRRORED);
+}
+
+int chip8_run_frames(struct chip8_state* state, uint16_t keys, uint32_t frames, uint32_t cycles, uint64_t* progress)
+{
+  chip8_set_keys(state, keys);
+  state->fault = CHIP8_FAULT_NONE;
+
+  // Each frame is cycles instructions and then the tick.
+  uint32_t frame = *progress / (cycles + 1);
+  uint32_t i = *progress % (cycles + 1);
+  for (; frame < frames; ++frame, i = 0)
+  {
+    for (; i < cycles; ++i)
+    {
+      chip8_cycle(state);
+      if (state->fault != CHIP8_FAULT_NONE)
+      {
+        *progress = (uint64_t)frame * (cycles + 1) + i + 1;
+        return CHIP8_EXIT_FAULT;
+      }
+    }
+    chip8_timer_tick(state);
+  }
+  *progress = (uint64_t)frames * (cycles + 1);
+  return CHIP8_EXIT_DONE;
+}
+
+int chip8_run_frames_through(struct chip8_state* state, uint16_t keys, uint32_t frames, uint32_t cycles)
+{
+  uint64_t progress = 0;
+  uint8_t fault = CHIP8_FAULT_NONE;
+  uint16_t fault_pc = 0;
+  uint16_t fault_opcode = 0;
+  while (chip8_run_frames(state, keys, frames, cycles, &progress) == CHIP8_EXIT_FAULT)
+  {
+    fault = state->fault;
+    fault_pc = state->fault_pc;
+    fault_opcode = state->fault_opcode;
+  }
+
+  // Every call clears fault, put the last one back.
+  if (fault == CHIP8_FAULT_NONE)
+  {
+    return CHIP8_EXIT_DONE;
+  }
+  state->fault = fault;
+  state->fault_pc = fault_pc;
+  state->fault_opcode = fault_opcode;
+  return CHIP8_EXIT_FAULT;
+}
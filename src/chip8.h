@@ -1,32 +1,118 @@
 #ifndef CHIP8_H
 #define CHIP8_H
 
+#include <stddef.h>
 #include <stdint.h>
 
 
 #define CHIP8_SCREEN_WIDTH 64
 #define CHIP8_SCREEN_HEIGHT 32
+// One bit per pixel, bit i of each byte is pixel x % 8 == i.
+#define CHIP8_PACKED_DISPLAY_SIZE (CHIP8_SCREEN_WIDTH * CHIP8_SCREEN_HEIGHT / 8)
+// Instructions per 60 Hz timer tick when running without a window.
+#define CHIP8_CYCLES_PER_FRAME 10
+// Granularity of memory shared between states, see shared_pages.
+#define CHIP8_PAGE_SIZE 256
 
+// What went wrong in the last faulting instruction, see chip8_state.fault.
+// A faulting instruction is skipped, except that a memory access past
+// 0xFFF still completes wrapped to the start of memory, and a key test of a
+// key past 0xF tests that key & 0xF.
+#define CHIP8_FAULT_NONE 0
+#define CHIP8_FAULT_UNKNOWN_OPCODE 1
+#define CHIP8_FAULT_STACK_OVERFLOW 2  // CALL with all 16 entries in use
+#define CHIP8_FAULT_STACK_UNDERFLOW 3 // RET with an empty stack
+#define CHIP8_FAULT_MEMORY 4          // access past 0xFFF, or Ex9E/ExA1 with Vx past 0xF
+#define CHIP8_FAULT_COUNT 5
+
+// Why chip8_run_frames returned.
+#define CHIP8_EXIT_DONE 0  // every frame ran
+#define CHIP8_EXIT_FAULT 1 // stopped right after a faulting instruction, see progress
+
+// Registers, timers and the stack share the first cache line, so stepping
+// many instances in turn touches one line per instance before memory.
+// Allocate with aligned_alloc(64, ...) or new_chip8.
 struct chip8_state
 {
-  uint8_t memory[4096];
-  uint8_t display[64 * 32];
-  uint16_t stack[16];
-  uint8_t V[16];
-  uint8_t input[16];
-  uint8_t waiting_input[16];
+  _Alignas(64) uint8_t V[16];
   uint16_t I;
   uint16_t pc;
   uint8_t sp;
   uint8_t delay_timer;
   uint8_t sound_timer;
   uint8_t draw_flag;
+  uint32_t rng;
+  // Bit y is set when row y may have changed, the frontend clears it.
+  uint32_t dirty_rows;
+  uint16_t stack[16];
+
+  uint8_t input[16];
+  uint8_t waiting_input[16];
+  // Bit p set means memory page p is still read from shared_memory, an image
+  // many states point to, and the first write to the page copies it into
+  // memory. 0 for a state that owns all of its memory.
+  uint16_t shared_pages;
+  // The last fault and where it happened, until the run loop or whoever
+  // reads it sets fault back to CHIP8_FAULT_NONE. fault_counts[f - 1]
+  // counts fault f over the state's life.
+  uint8_t fault;
+  uint16_t fault_pc;
+  uint16_t fault_opcode;
+  const uint8_t* shared_memory;
+  uint32_t fault_counts[CHIP8_FAULT_COUNT - 1];
+
+  _Alignas(64) uint8_t display[64 * 32];
+  // Last, so a mirrored state can map more copies of it right after.
+  _Alignas(64) uint8_t memory[4096];
 };
 
+_Static_assert(offsetof(struct chip8_state, input) == 64, "registers, timers and stack fill exactly one cache line");
+_Static_assert(offsetof(struct chip8_state, display) == 128, "input, sharing and faults fill the second line");
+_Static_assert(offsetof(struct chip8_state, memory) % 64 == 0, "memory starts on a cache line");
+_Static_assert(offsetof(struct chip8_state, display) % 64 == 0, "display starts on a cache line");
+_Static_assert(sizeof(struct chip8_state) % 64 == 0, "arrays of states keep every state aligned");
+_Static_assert(offsetof(struct chip8_state, memory) + 4096 == sizeof(struct chip8_state), "memory ends the state");
+
+// Reads guest memory, wherever its page currently lives.
+static inline uint8_t chip8_read(const struct chip8_state* state, uint16_t address)
+{
+  const uint8_t* memory = state->shared_pages >> (address >> 8 & 0x0F) & 1 ? state->shared_memory : state->memory;
+  return memory[address];
+}
+
 struct chip8_state* new_chip8();
+// What new_chip8 does, for a state allocated elsewhere.
+void chip8_init(struct chip8_state* state);
+// Copies every shared page into memory, after which the state no longer
+// depends on shared_memory.
+void chip8_own_memory(struct chip8_state* state);
 void load_program(struct chip8_state* state, char* program_path);
 void delete_chip8(struct chip8_state* state);
+void chip8_seed(struct chip8_state* state, uint32_t seed);
+void chip8_set_keys(struct chip8_state* state, uint16_t keys);
 void chip8_cycle();
+// chip8_cycle for a state from new_chip8_mirrored, indexing memory without
+// wrapping addresses first. Faults are recorded like chip8_cycle does.
+void chip8_cycle_mirrored(struct chip8_state* state);
+// chip8_cycle_mirrored with the wraps put back, for a normal state that
+// shares no pages. Only there to measure what the mirrors save.
+void chip8_cycle_masked(struct chip8_state* state);
+void chip8_timer_tick(struct chip8_state* state);
+void chip8_pack_display(struct chip8_state* state, uint8_t* packed);
+// Repacks the rows set in rows into an earlier packing of this display and
+// returns the rows whose pixels actually differ.
+uint32_t chip8_pack_rows(struct chip8_state* state, uint8_t* packed, uint32_t rows);
+void chip8_snapshot(struct chip8_state* state, struct chip8_state* snapshot);
+void chip8_restore(struct chip8_state* state, struct chip8_state* snapshot);
+// Runs frames frames with keys held, each is cycles instructions and a timer
+// tick. *progress counts the steps of those frames already taken, an
+// instruction or a tick each, and starts at 0. Returns CHIP8_EXIT_FAULT as
+// soon as an instruction faults, with progress just past it, and calling
+// again with the same arguments finishes the frames. Clears fault first.
+int chip8_run_frames(struct chip8_state* state, uint16_t keys, uint32_t frames, uint32_t cycles, uint64_t* progress);
+// chip8_run_frames to the last frame however often it faults. Returns
+// CHIP8_EXIT_FAULT when anything faulted, fault holds the last one.
+int chip8_run_frames_through(struct chip8_state* state, uint16_t keys, uint32_t frames, uint32_t cycles);
 
 
 #endif
\ No newline at end of file
@@ -0,0 +1,89 @@
+#include "fault.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+const char* chip8_fault_names[CHIP8_FAULT_COUNT] = {
+  "None",
+  "Unknown opcode",
+  "Stack overflow",
+  "Stack underflow",
+  "Out of range access",
+};
+
+struct fault_log* new_fault_log(FILE* out, uint64_t interval_ns)
+{
+  struct fault_log* log = malloc(sizeof(struct fault_log));
+  memset(log, 0, sizeof(struct fault_log));
+  log->out = out;
+  log->interval_ns = interval_ns;
+  return log;
+}
+
+void delete_fault_log(struct fault_log* log)
+{
+  free(log);
+}
+
+// "<count> <name>" for every kind counted since since, comma separated.
+static void write_counts(FILE* out, const uint32_t* counts, const uint32_t* since)
+{
+  const char* separator = "";
+  for (int i = 0; i < CHIP8_FAULT_COUNT - 1; ++i)
+  {
+    uint32_t count = counts[i] - (since != NULL ? since[i] : 0);
+    if (count > 0)
+    {
+      fprintf(out, "%s%u %s", separator, count, chip8_fault_names[i + 1]);
+      separator = ", ";
+    }
+  }
+}
+
+int fault_log_update(struct fault_log* log, struct chip8_state* state, uint64_t now_ns)
+{
+  uint64_t total = 0;
+  for (int i = 0; i < CHIP8_FAULT_COUNT - 1; ++i)
+  {
+    total += state->fault_counts[i] - log->reported[i];
+  }
+  if (total == 0 || now_ns < log->next_report_ns)
+  {
+    return 0;
+  }
+
+  // A run loop may have cleared fault since, the counts still show it.
+  fputs("(ERROR) ", log->out);
+  if (state->fault != CHIP8_FAULT_NONE)
+  {
+    fprintf(log->out, "%s: 0x%04X at 0x%03X", chip8_fault_names[state->fault], state->fault_opcode, state->fault_pc);
+  }
+  if (total > 1 || state->fault == CHIP8_FAULT_NONE)
+  {
+    fprintf(log->out, "%s%llu fault(s) since the last report (", state->fault != CHIP8_FAULT_NONE ? ", " : "",
+      (unsigned long long)total);
+    write_counts(log->out, state->fault_counts, log->reported);
+    fputc(')', log->out);
+  }
+  fputc('\n', log->out);
+
+  memcpy(log->reported, state->fault_counts, sizeof(log->reported));
+  log->next_report_ns = now_ns + log->interval_ns;
+  state->fault = CHIP8_FAULT_NONE;
+  return 1;
+}
+
+void fault_write_totals(struct chip8_state* state, FILE* out)
+{
+  uint32_t total = 0;
+  for (int i = 0; i < CHIP8_FAULT_COUNT - 1; ++i)
+  {
+    total += state->fault_counts[i];
+  }
+  if (total > 0)
+  {
+    fputs("Faults: ", out);
+    write_counts(out, state->fault_counts, NULL);
+    fputc('\n', out);
+  }
+}
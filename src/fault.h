@@ -0,0 +1,33 @@
+#ifndef FAULT_H
+#define FAULT_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "chip8.h"
+
+// Reports the faults of a state from outside the instruction loop, one line
+// per interval at most however fast a broken ROM faults, with how many of
+// each kind were not shown on their own.
+
+extern const char* chip8_fault_names[CHIP8_FAULT_COUNT];
+
+struct fault_log
+{
+  FILE* out;
+  uint64_t interval_ns;
+  uint64_t next_report_ns;
+  // fault_counts as of the last report
+  uint32_t reported[CHIP8_FAULT_COUNT - 1];
+};
+
+struct fault_log* new_fault_log(FILE* out, uint64_t interval_ns);
+void delete_fault_log(struct fault_log* log);
+
+// Prints the state's last fault and what it counted since the last report
+// if there is anything new and the interval has passed, then clears fault.
+// Returns 1 when it printed.
+int fault_log_update(struct fault_log* log, struct chip8_state* state, uint64_t now_ns);
+// One line with every fault the state counted, nothing when there are none.
+void fault_write_totals(struct chip8_state* state, FILE* out);
+
+#endif
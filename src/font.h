@@ -0,0 +1,14 @@
+#ifndef FONT_H
+#define FONT_H
+
+#include <stdint.h>
+
+// The debug overlay font, ASCII 32 to 127 at 8x8 pixels. Each glyph is one
+// byte per row with bit x set for pixel x.
+#define FONT_FIRST 32
+#define FONT_GLYPHS 96
+#define FONT_GLYPH_SIZE 8
+
+extern const uint8_t font_glyphs[FONT_GLYPHS][FONT_GLYPH_SIZE];
+
+#endif
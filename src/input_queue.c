@@ -0,0 +1,51 @@
+#include "input_queue.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+struct input_queue* new_input_queue()
+{
+  struct input_queue* queue = aligned_alloc(64, sizeof(struct input_queue));
+  memset(queue, 0, sizeof(struct input_queue));
+  atomic_init(&queue->head, 0);
+  atomic_init(&queue->tail, 0);
+  return queue;
+}
+
+void delete_input_queue(struct input_queue* queue)
+{
+  free(queue);
+}
+
+int input_queue_push(struct input_queue* queue, uint64_t time, uint8_t key, uint8_t pressed)
+{
+  uint32_t head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+  if (head - atomic_load_explicit(&queue->tail, memory_order_acquire) == INPUT_QUEUE_SIZE)
+  {
+    queue->dropped += 1;
+    return 0;
+  }
+
+  struct key_event* event = &queue->events[head % INPUT_QUEUE_SIZE];
+  event->time = time;
+  event->key = key;
+  event->pressed = pressed;
+  atomic_store_explicit(&queue->head, head + 1, memory_order_release);
+  return 1;
+}
+
+struct key_event* input_queue_peek(struct input_queue* queue)
+{
+  uint32_t tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+  if (tail == atomic_load_explicit(&queue->head, memory_order_acquire))
+  {
+    return NULL;
+  }
+  return &queue->events[tail % INPUT_QUEUE_SIZE];
+}
+
+void input_queue_pop(struct input_queue* queue)
+{
+  uint32_t tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+  atomic_store_explicit(&queue->tail, tail + 1, memory_order_release);
+}
@@ -0,0 +1,37 @@
+#ifndef INPUT_QUEUE_H
+#define INPUT_QUEUE_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+#define INPUT_QUEUE_SIZE 256
+
+struct key_event
+{
+  // Nanoseconds, TIME_UTC
+  uint64_t time;
+  uint8_t key;
+  uint8_t pressed;
+};
+
+// Single producer (the window thread) and single consumer (the emulation
+// thread). Events that do not fit are dropped and counted.
+struct input_queue
+{
+  struct key_event events[INPUT_QUEUE_SIZE];
+  _Alignas(64) _Atomic uint32_t head;
+  _Alignas(64) _Atomic uint32_t tail;
+  uint32_t dropped;
+};
+
+struct input_queue* new_input_queue();
+void delete_input_queue(struct input_queue* queue);
+
+// Producer side
+int input_queue_push(struct input_queue* queue, uint64_t time, uint8_t key, uint8_t pressed);
+
+// Consumer side, peek returns NULL when the queue is empty.
+struct key_event* input_queue_peek(struct input_queue* queue);
+void input_queue_pop(struct input_queue* queue);
+
+#endif
@@ -0,0 +1,96 @@
+#include "latency.h"
+
+#include <stdlib.h>
+
+const char* latency_stage_names[LATENCY_STAGE_COUNT] = {
+  "event to observe", "observe to publish", "publish to upload", "upload to swap", "event to swap"
+};
+
+const char* latency_stage_labels[LATENCY_STAGE_COUNT] = { "OBSERVE", "PUBLISH", "UPLOAD", "SWAP", "TOTAL" };
+
+struct latency* new_latency()
+{
+  return calloc(1, sizeof(struct latency));
+}
+
+void delete_latency(struct latency* latency)
+{
+  free(latency);
+}
+
+void latency_add(struct latency* latency, int stage, uint64_t nanoseconds)
+{
+  struct latency_histogram* histogram = &latency->stages[stage];
+  uint64_t bucket = nanoseconds / LATENCY_BUCKET_NS;
+  histogram->buckets[bucket < LATENCY_BUCKETS ? bucket : LATENCY_BUCKETS - 1] += 1;
+  histogram->count += 1;
+  histogram->total += nanoseconds;
+  if (nanoseconds > histogram->max)
+  {
+    histogram->max = nanoseconds;
+  }
+}
+
+uint64_t latency_percentile(struct latency* latency, int stage, double fraction)
+{
+  struct latency_histogram* histogram = &latency->stages[stage];
+  uint64_t target = histogram->count * fraction;
+  uint64_t seen = 0;
+  for (int i = 0; i < LATENCY_BUCKETS - 1; ++i)
+  {
+    seen += histogram->buckets[i];
+    if (seen > target)
+    {
+      return (uint64_t)(i + 1) * LATENCY_BUCKET_NS;
+    }
+  }
+  return histogram->max;
+}
+
+int latency_write(struct latency* latency, FILE* file)
+{
+  for (int stage = 0; stage < LATENCY_STAGE_COUNT; ++stage)
+  {
+    struct latency_histogram* histogram = &latency->stages[stage];
+    if (histogram->count == 0)
+    {
+      fprintf(file, "%-18s no samples\n", latency_stage_names[stage]);
+      continue;
+    }
+
+    fprintf(file, "%-18s %llu samples, mean %.2f ms, p50 %.2f ms, p90 %.2f ms, p99 %.2f ms, max %.2f ms\n",
+      latency_stage_names[stage], (unsigned long long)histogram->count,
+      histogram->total / (double)histogram->count / 1000000.0,
+      latency_percentile(latency, stage, 0.5) / 1000000.0,
+      latency_percentile(latency, stage, 0.9) / 1000000.0,
+      latency_percentile(latency, stage, 0.99) / 1000000.0,
+      histogram->max / 1000000.0);
+
+    for (int i = 0; i < LATENCY_BUCKETS; ++i)
+    {
+      if (histogram->buckets[i] != 0)
+      {
+        fprintf(file, "  %6.2f ms%s %llu\n", (i + 1) * LATENCY_BUCKET_NS / 1000000.0,
+          i == LATENCY_BUCKETS - 1 ? "+" : " ", (unsigned long long)histogram->buckets[i]);
+      }
+    }
+  }
+
+  return ferror(file) ? -1 : 0;
+}
+
+int latency_observed_key(struct chip8_state* state)
+{
+  uint16_t opcode = chip8_read(state, state->pc & 0x0FFF) << 8 | chip8_read(state, (state->pc + 1) & 0x0FFF);
+  uint8_t x = (opcode >> 8) & 0x0F;
+
+  switch (opcode & 0xF0FF)
+  {
+    case 0xE09E:
+    case 0xE0A1:
+      return state->V[x] & 0x0F;
+    case 0xF00A:
+      return LATENCY_ANY_KEY;
+  }
+  return -1;
+}
@@ -0,0 +1,51 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "chip8.h"
+
+// Stages between a key event and the swap that first shows its effect.
+#define LATENCY_OBSERVE 0 // event to the first instruction that reads the key
+#define LATENCY_PUBLISH 1 // that instruction to the frame being published
+#define LATENCY_UPLOAD 2  // published to picked up and uploaded by the render thread
+#define LATENCY_SWAP 3    // upload to glfwSwapBuffers returning
+#define LATENCY_TOTAL 4   // event to glfwSwapBuffers returning
+#define LATENCY_STAGE_COUNT 5
+
+// 250 us buckets, the last one also holds everything above 64 ms.
+#define LATENCY_BUCKET_NS 250000
+#define LATENCY_BUCKETS 256
+
+#define LATENCY_ANY_KEY 16
+
+struct latency_histogram
+{
+  uint64_t buckets[LATENCY_BUCKETS];
+  uint64_t count;
+  uint64_t total;
+  uint64_t max;
+};
+
+struct latency
+{
+  struct latency_histogram stages[LATENCY_STAGE_COUNT];
+};
+
+extern const char* latency_stage_names[LATENCY_STAGE_COUNT];
+// Names short enough for the debug overlay.
+extern const char* latency_stage_labels[LATENCY_STAGE_COUNT];
+
+struct latency* new_latency();
+void delete_latency(struct latency* latency);
+
+void latency_add(struct latency* latency, int stage, uint64_t nanoseconds);
+// Upper bound of the bucket holding the given fraction of samples, in nanoseconds.
+uint64_t latency_percentile(struct latency* latency, int stage, double fraction);
+int latency_write(struct latency* latency, FILE* file);
+
+// The key the instruction at pc is about to read, LATENCY_ANY_KEY for Fx0A,
+// -1 when it does not read input.
+int latency_observed_key(struct chip8_state* state);
+
+#endif
@@ -1,59 +1,638 @@
 #include "chip8.h"
 #include "renderer.h"
+#include "profiler.h"
+#include "trace.h"
+#include "movie.h"
+#include "triple_buffer.h"
+#include "input_queue.h"
+#include "latency.h"
+#include "software.h"
+#include "terminal.h"
+#include "capture.h"
+#include "fault.h"
 
 
 #include <stdio.h>
 #include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
 #include <time.h>
+#include <threads.h>
+#include <stdatomic.h>
+#include <signal.h>
 
-int main(int argc, char* argv[])
+#ifndef _WIN32
+#include <sys/time.h>
+#endif
+
+static struct profiler* profiler = NULL;
+
+#ifndef _WIN32
+static void on_sigprof(int signal)
 {
-  init_renderer();
+  profiler_request_sample(profiler);
+}
+#endif
 
-  struct chip8_state* state = new_chip8();
-  load_program(state, "../c8games/tetris.ch8");
+// Everything the emulation thread owns, plus the two queues it shares with
+// the render thread: finished frames go out through the triple buffer and
+// key events come back through the input queue.
+struct emulator
+{
+  struct chip8_state* state;
+  struct trace* trace;
+  struct movie* movie;
+  struct capture* capture;
+  struct fault_log* faults;
+  struct triple_buffer* frames;
+  struct input_queue* input;
+  uint64_t frame_count;
+  uint64_t ticks;
+  uint64_t instructions;
+  uint16_t keys;
+  atomic_int running;
+
+  // The overlay shows registers, which change while the display does not,
+  // so with it on a frame goes out every tick.
+  int overlay_frames;
+
+  // Run-ahead, frames to emulate past the real state on a copy of it.
+  uint32_t run_ahead;
+  struct chip8_state* ahead;
+
+  // The real display as last published, only dirty rows are repacked.
+  uint8_t packed[CHIP8_PACKED_DISPLAY_SIZE];
+
+  // Latency, times of key events the guest has not read yet and of the
+  // oldest read one not yet on screen. The render thread acknowledges
+  // frames it has measured so a frame dropped by the triple buffer passes
+  // its input on to the next one.
+  int measure_latency;
+  uint64_t unobserved[16];
+  uint64_t input_time;
+  uint64_t observed_time;
+  _Atomic uint64_t acknowledged;
+};
+
+static uint64_t now_ns()
+{
+  struct timespec time;
+  timespec_get(&time, TIME_UTC);
+  return time.tv_sec * 1000000000ull + time.tv_nsec;
+}
+
+// A frame published only for the overlay carries no input, the guest's
+// answer to it is not on screen yet.
+static void publish_frame(struct emulator* emulator, const uint8_t* packed, int overlay_only)
+{
+  struct frame* frame = triple_buffer_back(emulator->frames);
+  memcpy(frame->display, packed, CHIP8_PACKED_DISPLAY_SIZE);
+  frame->number = ++emulator->frame_count;
+  frame->published = now_ns();
+  if (emulator->observed_time != 0 && atomic_load_explicit(&emulator->acknowledged, memory_order_relaxed) >= emulator->observed_time)
+  {
+    emulator->input_time = 0;
+    emulator->observed_time = 0;
+  }
+  frame->input = overlay_only ? 0 : emulator->input_time;
+  frame->observed = overlay_only ? 0 : emulator->observed_time;
+
+  struct chip8_state* state = emulator->state;
+  frame->pc = state->pc;
+  frame->I = state->I;
+  frame->sp = state->sp;
+  frame->delay_timer = state->delay_timer;
+  frame->sound_timer = state->sound_timer;
+  memcpy(frame->V, state->V, sizeof(frame->V));
+  frame->instructions = emulator->instructions;
+  triple_buffer_publish(emulator->frames);
+}
+
+// Applies the key events that happened up to now, which makes the next
+// instruction the closest one to each of them. A key changes at most once
+// per instruction so even a tap shorter than a cycle is seen by the guest.
+static int apply_input(struct emulator* emulator, uint64_t now)
+{
+  uint16_t changed = 0;
+  struct key_event* event;
+  while ((event = input_queue_peek(emulator->input)) != NULL && event->time <= now && (changed & 1 << event->key) == 0)
+  {
+    changed |= 1 << event->key;
+    emulator->unobserved[event->key] = event->time;
+    emulator->keys = event->pressed ? emulator->keys | 1 << event->key : emulator->keys & ~(1 << event->key);
+    input_queue_pop(emulator->input);
+  }
+  return changed != 0;
+}
+
+static void observe_input(struct emulator* emulator, uint64_t now)
+{
+  int key = latency_observed_key(emulator->state);
+  if (key < 0)
+  {
+    return;
+  }
+
+  uint64_t oldest = 0;
+  for (int i = key == LATENCY_ANY_KEY ? 0 : key; i < (key == LATENCY_ANY_KEY ? 16 : key + 1); ++i)
+  {
+    if (emulator->unobserved[i] != 0 && (oldest == 0 || emulator->unobserved[i] < oldest))
+    {
+      oldest = emulator->unobserved[i];
+    }
+    emulator->unobserved[i] = 0;
+  }
+
+  if (oldest != 0 && emulator->observed_time == 0)
+  {
+    emulator->input_time = oldest;
+    emulator->observed_time = now;
+  }
+}
+
+static volatile sig_atomic_t interrupted = 0;
+
+static void on_sigint(int signal)
+{
+  interrupted = 1;
+}
+
+// Without a window every new frame goes to the software renderer, and to
+// ppm_path when given, or to the terminal until the process is interrupted.
+static void present_headless(struct emulator* emulator, struct software_renderer* software, const char* ppm_path, struct terminal* terminal)
+{
+  while (!interrupted && (terminal == NULL || !terminal->quit))
+  {
+    if (terminal != NULL)
+    {
+      terminal_poll(terminal, now_ns());
+    }
+
+    struct frame* frame = triple_buffer_acquire(emulator->frames);
+    if (frame == NULL)
+    {
+      thrd_sleep(&(struct timespec){ .tv_nsec = 1000000 }, NULL);
+      continue;
+    }
+    if (terminal != NULL)
+    {
+      terminal_render_frame(terminal, frame->display);
+    }
+    if (software != NULL && software_render_frame(software, frame->display) != 0 && ppm_path != NULL)
+    {
+      software_write_ppm(software, ppm_path);
+    }
+  }
+}
+
+static int emulate(void* argument)
+{
+  struct emulator* emulator = argument;
+  struct chip8_state* state = emulator->state;
+  struct trace* trace = emulator->trace;
+  struct movie* movie = emulator->movie;
+
+  // While recording, keys only change on timer ticks so the movie can
+  // replay them at the same instruction.
+  uint16_t frame_keys = 0;
+  uint16_t frame_cycles = 0;
+  // Frames published up to the last tick.
+  uint64_t tick_frames = 0;
 
   struct timespec time;
   int64_t last_cycle = 0;
   int64_t last_timer = 0;
-  int64_t clock_cycle;
-  while (!should_close())
+  while (atomic_load_explicit(&emulator->running, memory_order_relaxed))
   {
-    poll_window(state);
-
     timespec_get(&time, TIME_UTC);
     int64_t current_time = time.tv_sec * 1000 + time.tv_nsec * 0.000001;
 
     if (current_time > last_cycle + 2)
     {
       last_cycle = current_time;
+      if (apply_input(emulator, time.tv_sec * 1000000000ull + time.tv_nsec) && movie == NULL)
+      {
+        chip8_set_keys(state, emulator->keys);
+      }
+      if (trace != NULL)
+      {
+        trace_record(trace, state);
+      }
+      if (emulator->measure_latency)
+      {
+        observe_input(emulator, now_ns());
+      }
       chip8_cycle(state);
+      frame_cycles += 1;
+      emulator->instructions += 1;
+      if (profiler != NULL)
+      {
+        profiler_tick(profiler, state);
+      }
     }
 
     if (current_time > last_timer + 17)
     {
       last_timer = current_time;
-      if (state->sound_timer > 0)
+      chip8_timer_tick(state);
+      if (trace != NULL)
+      {
+        trace_tick(trace);
+      }
+      emulator->ticks += 1;
+      fault_log_update(emulator->faults, state, now_ns());
+
+      // Never waits, a display that finds the queue full is dropped.
+      if (emulator->capture != NULL)
+      {
+        uint8_t packed[CHIP8_PACKED_DISPLAY_SIZE];
+        chip8_pack_display(state, packed);
+        capture_frame(emulator->capture, packed, emulator->ticks, 0);
+      }
+
+      if (movie != NULL)
       {
-        state->sound_timer -= 1;
+        movie_record_frame(movie, frame_keys, frame_cycles, state);
+        frame_keys = emulator->keys;
+        chip8_set_keys(state, frame_keys);
       }
 
-      if (state->delay_timer > 0)
+      // Show where the game will be run_ahead frames from now if the keys
+      // stay as they are. The copy is thrown away, so tracing, profiling
+      // and recording only ever see the real state.
+      if (emulator->run_ahead > 0)
+      {
+        // Faults on the copy are reported once the real state reaches them.
+        chip8_snapshot(state, emulator->ahead);
+        chip8_run_frames_through(emulator->ahead, emulator->keys, emulator->run_ahead, frame_cycles);
+        state->draw_flag = 0;
+        state->dirty_rows = 0;
+        uint8_t packed[CHIP8_PACKED_DISPLAY_SIZE];
+        chip8_pack_display(emulator->ahead, packed);
+        publish_frame(emulator, packed, 0);
+      }
+      else if (emulator->overlay_frames && emulator->frame_count == tick_frames)
       {
-        state->delay_timer -= 1;
+        publish_frame(emulator, emulator->packed, 1);
       }
+      tick_frames = emulator->frame_count;
+      frame_cycles = 0;
     }
 
-    if (state->draw_flag != 0)
+    // XOR drawing often puts back the pixels it took away, such frames are
+    // not published at all.
+    if (state->draw_flag != 0 && emulator->run_ahead == 0)
     {
       state->draw_flag = 0;
-      render_display(state);
+      uint32_t changed = chip8_pack_rows(state, emulator->packed, state->dirty_rows);
+      state->dirty_rows = 0;
+      if (changed != 0)
+      {
+        publish_frame(emulator, emulator->packed, 0);
+      }
+    }
+
+    // Sleep until the next cycle or timer tick is due.
+    int64_t next = last_cycle + 3 < last_timer + 18 ? last_cycle + 3 : last_timer + 18;
+    if (next > current_time)
+    {
+      thrd_sleep(&(struct timespec){ .tv_nsec = (next - current_time) * 1000000 }, NULL);
+    }
+  }
+
+  return 0;
+}
+
+int main(int argc, char* argv[])
+{
+  uint64_t launched = now_ns();
+  char* program_path = "../c8games/tetris.ch8";
+  char* profile_path = NULL;
+  int profile_timer = 0;
+  char* trace_path = NULL;
+  uint64_t trace_ring = 0;
+  char* movie_path = NULL;
+  char* capture_path = NULL;
+  int measure_latency = 0;
+  uint32_t run_ahead = 0;
+  int show_debug = 0;
+  int show_startup = 0;
+  char* software_target = NULL;
+  int use_terminal = 0;
+  uint32_t scale = 10;
+  for (int i = 1; i < argc; ++i)
+  {
+    if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc)
+    {
+      profile_path = argv[++i];
+    }
+    else if (strcmp(argv[i], "--profile-timer") == 0)
+    {
+      profile_timer = 1;
+    }
+    else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+    {
+      trace_path = argv[++i];
+    }
+    else if (strcmp(argv[i], "--trace-ring") == 0 && i + 1 < argc)
+    {
+      trace_ring = strtoull(argv[++i], NULL, 10);
+    }
+    else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc)
+    {
+      movie_path = argv[++i];
+    }
+    else if (strcmp(argv[i], "--capture") == 0 && i + 1 < argc)
+    {
+      capture_path = argv[++i];
+    }
+    else if (strcmp(argv[i], "--latency") == 0)
+    {
+      measure_latency = 1;
+    }
+    else if (strcmp(argv[i], "--debug") == 0)
+    {
+      show_debug = 1;
+    }
+    else if (strcmp(argv[i], "--startup") == 0)
+    {
+      show_startup = 1;
+    }
+    else if (strcmp(argv[i], "--software") == 0 && i + 1 < argc)
+    {
+      software_target = argv[++i];
+    }
+    else if (strcmp(argv[i], "--terminal") == 0)
+    {
+      use_terminal = 1;
+    }
+    else if (strcmp(argv[i], "--scale") == 0 && i + 1 < argc)
+    {
+      scale = strtoul(argv[++i], NULL, 10);
+    }
+    else if (strcmp(argv[i], "--run-ahead") == 0 && i + 1 < argc)
+    {
+      run_ahead = strtoul(argv[++i], NULL, 10);
+    }
+    else
+    {
+      program_path = argv[i];
+    }
+  }
+
+  // --software out.ppm or --software shm:/name presents without OpenGL.
+  struct software_renderer* software = NULL;
+  char* ppm_path = NULL;
+  if (software_target != NULL)
+  {
+    int shared = strncmp(software_target, "shm:", 4) == 0;
+    software = new_software_renderer(scale > 0 ? scale : 1, shared ? software_target + 4 : NULL);
+    ppm_path = shared ? NULL : software_target;
+  }
+  // --terminal draws with half blocks on stdout and reads keys from stdin.
+  struct terminal* terminal = NULL;
+  if (use_terminal)
+  {
+    terminal = new_terminal();
+    if (terminal == NULL)
+    {
+      return 1;
+    }
+  }
+  int headless = software != NULL || terminal != NULL;
+  if (headless)
+  {
+    signal(SIGINT, on_sigint);
+  }
+  else
+  {
+    init_renderer();
+  }
+
+  struct chip8_state* state = new_chip8();
+  load_program(state, program_path);
+
+  if (profile_path != NULL)
+  {
+    // Sample every 64 instructions, or on SIGPROF when --profile-timer is given.
+    profiler = new_profiler(profile_timer ? 0 : 64);
+
+#ifndef _WIN32
+    if (profile_timer)
+    {
+      signal(SIGPROF, on_sigprof);
+      struct itimerval timer = { { 0, 1000 }, { 0, 1000 } };
+      setitimer(ITIMER_PROF, &timer, NULL);
+    }
+#endif
+  }
+
+  struct trace* trace = NULL;
+  if (trace_path != NULL)
+  {
+    trace = new_trace(trace_path, trace_ring);
+  }
+
+  struct movie* movie = NULL;
+  if (movie_path != NULL)
+  {
+    movie = new_movie(movie_path, state, program_path, 60);
+  }
+
+  struct capture* capture = NULL;
+  if (capture_path != NULL)
+  {
+    capture = new_capture(capture_path, 4);
+  }
+
+  // Faults go to stderr, at most once a second, so a broken ROM can neither
+  // flood the terminal nor slow the emulation down.
+  struct fault_log* faults = new_fault_log(stderr, 1000000000ull);
+  struct emulator emulator = { state, trace, movie, capture, faults, new_triple_buffer(), new_input_queue(), 0, 0, 0 };
+  atomic_init(&emulator.running, 1);
+  emulator.measure_latency = measure_latency;
+  emulator.overlay_frames = show_debug && !headless;
+  emulator.run_ahead = run_ahead;
+  emulator.ahead = run_ahead > 0 ? new_chip8() : NULL;
+  atomic_init(&emulator.acknowledged, 0);
+  set_input_queue(emulator.input);
+  if (terminal != NULL)
+  {
+    terminal->input = emulator.input;
+  }
+
+  struct latency* latency = measure_latency ? new_latency() : NULL;
+  uint64_t last_measured = 0;
+  uint64_t last_title = 0;
+
+  struct debug_stats stats = { 0 };
+  uint64_t last_swap = 0;
+  uint64_t mips_time = now_ns();
+  uint64_t mips_instructions = 0;
+
+  thrd_t emulation;
+  thrd_create(&emulation, emulate, &emulator);
+
+  if (headless)
+  {
+    present_headless(&emulator, software, ppm_path, terminal);
+  }
+
+  // The window has to be serviced from the main thread, so this one renders.
+  while (!headless && !should_close())
+  {
+    struct frame* frame = triple_buffer_acquire(emulator.frames);
+    if (frame != NULL)
+    {
+      uint64_t upload = now_ns();
+      if (show_debug)
+      {
+        stats.pc = frame->pc;
+        stats.I = frame->I;
+        stats.sp = frame->sp;
+        stats.delay_timer = frame->delay_timer;
+        stats.sound_timer = frame->sound_timer;
+        memcpy(stats.V, frame->V, sizeof(stats.V));
+        // Instruction rate over roughly half a second
+        if (upload - mips_time > 500000000ull)
+        {
+          stats.mips = (frame->instructions - mips_instructions) * 1000.0 / (upload - mips_time);
+          mips_time = upload;
+          mips_instructions = frame->instructions;
+        }
+        render_debug(&stats);
+      }
+      if (!render_frame(frame->display))
+      {
+        // Same pixels as on screen, nothing was swapped to measure.
+        poll_window();
+        continue;
+      }
+      uint64_t swap = now_ns();
+      poll_window();
+      stats.frame_time = last_swap != 0 ? (swap - last_swap) / 1000000.0 : 0.0;
+      if (show_startup && last_swap == 0)
+      {
+        const struct render_startup* startup = render_startup_times();
+        printf("First frame after %.2f ms (window and context %.2f ms, GL setup %.2f ms, %d programs from cache)\n",
+          (swap - launched) / 1000000.0, startup->context, startup->setup, startup->cached_programs);
+      }
+      last_swap = swap;
+
+      if (latency != NULL && frame->observed > last_measured)
+      {
+        last_measured = frame->observed;
+        atomic_store_explicit(&emulator.acknowledged, frame->observed, memory_order_relaxed);
+        latency_add(latency, LATENCY_OBSERVE, frame->observed - frame->input);
+        latency_add(latency, LATENCY_PUBLISH, frame->published - frame->observed);
+        latency_add(latency, LATENCY_UPLOAD, upload - frame->published);
+        latency_add(latency, LATENCY_SWAP, swap - upload);
+        latency_add(latency, LATENCY_TOTAL, swap - frame->input);
+      }
+
+      // With --debug the overlay shows every stage, otherwise the window
+      // title shows the total.
+      if (latency != NULL && show_debug && swap - last_title > 500000000ull)
+      {
+        last_title = swap;
+        stats.show_latency = 1;
+        for (int stage = 0; stage < LATENCY_STAGE_COUNT; ++stage)
+        {
+          stats.latency_p50[stage] = latency_percentile(latency, stage, 0.5) / 1000000.0;
+          stats.latency_p99[stage] = latency_percentile(latency, stage, 0.99) / 1000000.0;
+        }
+      }
+      else if (latency != NULL && !show_debug && swap - last_title > 1000000000ull)
+      {
+        last_title = swap;
+        char status[128] = "input to photon: press a key";
+        if (latency->stages[LATENCY_TOTAL].count != 0)
+        {
+          snprintf(status, sizeof(status), "input to photon p50 %.1f ms, p99 %.1f ms (%llu samples)",
+            latency_percentile(latency, LATENCY_TOTAL, 0.5) / 1000000.0,
+            latency_percentile(latency, LATENCY_TOTAL, 0.99) / 1000000.0,
+            (unsigned long long)latency->stages[LATENCY_TOTAL].count);
+        }
+        render_set_status(status);
+      }
+    }
+    else
+    {
+      wait_window(0.001);
     }
 
     // getchar();
   }
 
+  atomic_store(&emulator.running, 0);
+  thrd_join(emulation, NULL);
+  set_input_queue(NULL);
+  delete_input_queue(emulator.input);
+  delete_triple_buffer(emulator.frames);
+  if (software != NULL)
+  {
+    delete_software_renderer(software);
+  }
+  if (terminal != NULL)
+  {
+    uint64_t frames = terminal->frames;
+    uint64_t bytes = terminal->bytes;
+    delete_terminal(terminal);
+    printf("Terminal: %llu frames, %.1f bytes per frame\n", (unsigned long long)frames, frames != 0 ? (double)bytes / frames : 0.0);
+  }
+  if (capture != NULL)
+  {
+    finish_capture(capture, emulator.ticks);
+    printf("Capture: %llu frames in %llu ticks, %llu dropped, %llu bytes\n", (unsigned long long)capture->frames,
+      (unsigned long long)emulator.ticks, (unsigned long long)capture->dropped, (unsigned long long)capture->bytes);
+    delete_capture(capture);
+  }
+  if (emulator.ahead != NULL)
+  {
+    delete_chip8(emulator.ahead);
+  }
+  fault_write_totals(state, stdout);
+  delete_fault_log(faults);
+
+  if (latency != NULL)
+  {
+    latency_write(latency, stdout);
+    delete_latency(latency);
+  }
+
+  if (profiler != NULL)
+  {
+#ifndef _WIN32
+    struct itimerval timer = { { 0, 0 }, { 0, 0 } };
+    setitimer(ITIMER_PROF, &timer, NULL);
+#endif
+
+    FILE* file = fopen(profile_path, "w");
+    if (file == NULL)
+    {
+      perror("Error");
+    }
+    else
+    {
+      profiler_write_folded(profiler, file);
+      fclose(file);
+    }
+    delete_profiler(profiler);
+  }
+
+  // Write errors were reported as they happened.
+  int result = 0;
+  if (trace != NULL && delete_trace(trace) != 0)
+  {
+    result = 1;
+  }
+
+  if (movie != NULL)
+  {
+    close_movie(movie);
+  }
+
   delete_chip8(state);
 
-  return 0;
+  return result;
 }
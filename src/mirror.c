@@ -0,0 +1,94 @@
+#include "mirror.h"
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#define MIRROR_PAGE_SIZE sizeof(((struct chip8_state*)0)->memory)
+// One page for the registers and display, which end where memory starts.
+#define MIRROR_MAPPED_SIZE ((1 + CHIP8_MIRROR_COPIES) * MIRROR_PAGE_SIZE)
+
+_Static_assert(offsetof(struct chip8_state, memory) <= MIRROR_PAGE_SIZE, "everything before memory fits in one page");
+
+#ifndef _WIN32
+static _Atomic uint32_t mirror_count;
+
+// An unlinked shared memory object, the page every copy maps.
+static int open_page()
+{
+  char name[64];
+  snprintf(name, sizeof(name), "/chip8-mirror-%ld-%u", (long)getpid(), atomic_fetch_add(&mirror_count, 1));
+  int file = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+  if (file < 0)
+  {
+    return -1;
+  }
+  shm_unlink(name);
+  if (ftruncate(file, MIRROR_PAGE_SIZE) != 0)
+  {
+    close(file);
+    return -1;
+  }
+  return file;
+}
+#endif
+
+struct chip8_state* new_chip8_mirrored()
+{
+#ifndef _WIN32
+  if (sysconf(_SC_PAGESIZE) != MIRROR_PAGE_SIZE)
+  {
+    return NULL;
+  }
+  int file = open_page();
+  if (file < 0)
+  {
+    perror("Error");
+    return NULL;
+  }
+
+  // Reserve the whole range first so the copies land next to each other.
+  uint8_t* base = mmap(NULL, MIRROR_MAPPED_SIZE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  int failed = base == MAP_FAILED;
+  if (!failed)
+  {
+    failed = mmap(base, MIRROR_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0)
+      == MAP_FAILED;
+  }
+  for (int i = 0; i < CHIP8_MIRROR_COPIES && !failed; ++i)
+  {
+    uint8_t* copy = base + (1 + i) * MIRROR_PAGE_SIZE;
+    failed = mmap(copy, MIRROR_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, file, 0) == MAP_FAILED;
+  }
+  close(file);
+  if (failed)
+  {
+    perror("Error");
+    if (base != MAP_FAILED)
+    {
+      munmap(base, MIRROR_MAPPED_SIZE);
+    }
+    return NULL;
+  }
+
+  struct chip8_state* state = (struct chip8_state*)(base + MIRROR_PAGE_SIZE - offsetof(struct chip8_state, memory));
+  chip8_init(state);
+  return state;
+#else
+  return NULL;
+#endif
+}
+
+void delete_chip8_mirrored(struct chip8_state* state)
+{
+#ifndef _WIN32
+  uint8_t* base = state->memory - MIRROR_PAGE_SIZE;
+  munmap(base, MIRROR_MAPPED_SIZE);
+#endif
+}
@@ -0,0 +1,20 @@
+#ifndef MIRROR_H
+#define MIRROR_H
+
+#include "chip8.h"
+
+// A state whose 4 KB memory is mapped CHIP8_MIRROR_COPIES times in a row,
+// all views of the same page, so memory[address] for any address below
+// 0x11000 is memory[address % 4096]. That covers every 16 bit pc and I plus
+// the 15 bytes Fx55, Fx65 and DXYN reach past I, and chip8_cycle_mirrored
+// can drop the masks. Run it with chip8_cycle_mirrored, it never shares
+// memory with a pool.
+
+#define CHIP8_MIRROR_COPIES 17
+
+// NULL when the host pages are not 4 KB or the platform cannot map a page
+// twice.
+struct chip8_state* new_chip8_mirrored();
+void delete_chip8_mirrored(struct chip8_state* state);
+
+#endif
@@ -0,0 +1,170 @@
+#include "mosaic.h"
+#include "renderer.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Tiles are laid out from u_first + gl_InstanceID, gl_InstanceID alone
+// selects the layer of the array that is bound.
+const char *mosaic_vertex_shader_src = "#version 330 core\n"
+  "uniform int u_columns;\n"
+  "uniform int u_first;\n"
+  "uniform vec2 u_tile;\n"
+  "out vec2 uv;\n"
+  "flat out int layer;\n"
+  "void main()\n"
+  "{\n"
+  "   vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1);\n"
+  "   int tile = u_first + gl_InstanceID;\n"
+  "   vec2 cell = vec2(tile % u_columns, tile / u_columns);\n"
+  "   vec2 inner = 0.04 + corner * 0.92;\n"
+  "   gl_Position = vec4(-1.0 + (cell.x + inner.x) * u_tile.x, 1.0 - (cell.y + inner.y) * u_tile.y, 0.0, 1.0);\n"
+  "   uv = corner;\n"
+  "   layer = gl_InstanceID;\n"
+  "}\0";
+
+const char *mosaic_fragment_shader_src = "#version 330 core\n"
+  "in vec2 uv;\n"
+  "flat in int layer;\n"
+  "uniform usampler2DArray u_tex;\n"
+  "uniform vec4 u_palette[2];\n"
+  "out vec4 color;\n"
+  "void main()\n"
+  "{\n"
+  "   ivec2 pixel = min(ivec2(uv * vec2(64.0, 32.0)), ivec2(63, 31));\n"
+  "   uint bits = texelFetch(u_tex, ivec3(pixel.x >> 3, pixel.y, layer), 0).r;\n"
+  "   color = u_palette[(bits >> uint(pixel.x & 7)) & 1u];\n"
+  "}\n\0";
+
+struct mosaic* new_mosaic(uint32_t count)
+{
+  struct mosaic* mosaic = malloc(sizeof(struct mosaic));
+  mosaic->count = count;
+
+  // The window is 3:1 and a tile 2:1, so this keeps the tiles about square
+  // to the window.
+  mosaic->columns = 1;
+  while (mosaic->columns * mosaic->columns * 2 < count * 3)
+  {
+    mosaic->columns += 1;
+  }
+  mosaic->rows = (count + mosaic->columns - 1) / mosaic->columns;
+
+  mosaic->packed = calloc(count, CHIP8_PACKED_DISPLAY_SIZE);
+  mosaic->dirty = calloc(count, 1);
+  mosaic->uploaded_tiles = 0;
+  mosaic->upload_calls = 0;
+
+  mosaic->shader = create_program(mosaic_vertex_shader_src, mosaic_fragment_shader_src);
+  glUseProgram(mosaic->shader);
+  glUniform1i(glGetUniformLocation(mosaic->shader, "u_tex"), 0);
+  glUniform1i(glGetUniformLocation(mosaic->shader, "u_columns"), mosaic->columns);
+  mosaic->first_location = glGetUniformLocation(mosaic->shader, "u_first");
+  glUniform2f(glGetUniformLocation(mosaic->shader, "u_tile"), 2.0f / mosaic->columns, 2.0f / mosaic->rows);
+  float palette[] = {
+    0.0f, 0.0f, 0.0f, 1.0f, // off
+    1.0f, 1.0f, 1.0f, 1.0f, // on
+  };
+  glUniform4fv(glGetUniformLocation(mosaic->shader, "u_palette"), 2, palette);
+
+  // Everything comes from gl_VertexID and gl_InstanceID, but a core context
+  // still wants a vertex array bound.
+  glGenVertexArrays(1, &mosaic->vao);
+
+  // GL 3.3 only promises 256 layers.
+  int max_layers = 0;
+  glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &max_layers);
+  mosaic->layers = max_layers > 0 && (uint32_t)max_layers < count ? (uint32_t)max_layers : count;
+  mosaic->texture_count = (count + mosaic->layers - 1) / mosaic->layers;
+  mosaic->textures = malloc(mosaic->texture_count * sizeof(unsigned int));
+
+  glGenTextures(mosaic->texture_count, mosaic->textures);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  for (uint32_t i = 0; i < mosaic->texture_count; ++i)
+  {
+    uint32_t first = i * mosaic->layers;
+    uint32_t layers = count - first < mosaic->layers ? count - first : mosaic->layers;
+    glBindTexture(GL_TEXTURE_2D_ARRAY, mosaic->textures[i]);
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_R8UI, CHIP8_SCREEN_WIDTH / 8, CHIP8_SCREEN_HEIGHT, layers, 0, GL_RED_INTEGER,
+      GL_UNSIGNED_BYTE, &mosaic->packed[first * CHIP8_PACKED_DISPLAY_SIZE]);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  }
+
+  return mosaic;
+}
+
+void delete_mosaic(struct mosaic* mosaic)
+{
+  glDeleteTextures(mosaic->texture_count, mosaic->textures);
+  free(mosaic->textures);
+  glDeleteVertexArrays(1, &mosaic->vao);
+  glDeleteProgram(mosaic->shader);
+  free(mosaic->packed);
+  free(mosaic->dirty);
+  free(mosaic);
+}
+
+uint32_t mosaic_update(struct mosaic* mosaic, struct chip8_state** states)
+{
+  // A set draw flag only means something was drawn, XOR drawing often puts
+  // back the same pixels, so the repacked rows are compared as well.
+  uint32_t changed = 0;
+  for (uint32_t i = 0; i < mosaic->count; ++i)
+  {
+    mosaic->dirty[i] = 0;
+    if (states[i]->draw_flag == 0)
+    {
+      continue;
+    }
+    states[i]->draw_flag = 0;
+
+    uint8_t* tile = &mosaic->packed[i * CHIP8_PACKED_DISPLAY_SIZE];
+    uint32_t rows = chip8_pack_rows(states[i], tile, states[i]->dirty_rows);
+    states[i]->dirty_rows = 0;
+    if (rows != 0)
+    {
+      mosaic->dirty[i] = 1;
+      changed += 1;
+    }
+  }
+
+  // Neighbouring dirty layers of one array are contiguous in packed too, so
+  // each run goes up in one call.
+  for (uint32_t i = 0; i < mosaic->count; ++i)
+  {
+    if (!mosaic->dirty[i])
+    {
+      continue;
+    }
+    uint32_t first = i;
+    while (i + 1 < mosaic->count && mosaic->dirty[i + 1] && (i + 1) % mosaic->layers != 0)
+    {
+      i += 1;
+    }
+    glBindTexture(GL_TEXTURE_2D_ARRAY, mosaic->textures[first / mosaic->layers]);
+    glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, first % mosaic->layers, CHIP8_SCREEN_WIDTH / 8, CHIP8_SCREEN_HEIGHT,
+      i - first + 1, GL_RED_INTEGER, GL_UNSIGNED_BYTE, &mosaic->packed[first * CHIP8_PACKED_DISPLAY_SIZE]);
+    mosaic->upload_calls += 1;
+  }
+
+  mosaic->uploaded_tiles += changed;
+  return changed;
+}
+
+void mosaic_draw(struct mosaic* mosaic)
+{
+  glClearColor(0.5f, 0.5f, 0.6f, 1.0f);
+  glClear(GL_COLOR_BUFFER_BIT);
+
+  glUseProgram(mosaic->shader);
+  glBindVertexArray(mosaic->vao);
+  for (uint32_t i = 0; i < mosaic->texture_count; ++i)
+  {
+    uint32_t first = i * mosaic->layers;
+    uint32_t layers = mosaic->count - first < mosaic->layers ? mosaic->count - first : mosaic->layers;
+    glUniform1i(mosaic->first_location, first);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, mosaic->textures[i]);
+    glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, layers);
+  }
+}
@@ -0,0 +1,44 @@
+#ifndef MOSAIC_H
+#define MOSAIC_H
+
+#include <stdint.h>
+#include "chip8.h"
+
+// Shows many instances at once. Every display is a layer of a texture
+// array and the tiles of each array are drawn by a single instanced call,
+// only layers whose pixels changed are uploaded. One array holds at most
+// GL_MAX_ARRAY_TEXTURE_LAYERS displays, more instances take more arrays.
+struct mosaic
+{
+  uint32_t count;
+  uint32_t columns;
+  uint32_t rows;
+
+  unsigned int shader;
+  unsigned int vao;
+  int first_location;
+  // Instance i is layer i % layers of textures[i / layers].
+  uint32_t layers;
+  uint32_t texture_count;
+  unsigned int* textures;
+
+  // Displays as last uploaded, CHIP8_PACKED_DISPLAY_SIZE bytes per instance.
+  uint8_t* packed;
+  uint8_t* dirty;
+  uint64_t uploaded_tiles;
+  uint64_t upload_calls;
+};
+
+// Needs the context made by init_renderer.
+struct mosaic* new_mosaic(uint32_t count);
+void delete_mosaic(struct mosaic* mosaic);
+
+// Uploads the displays of states that changed since the last update and
+// clears their draw flags and dirty rows. States start out blank, after that
+// only their dirty rows are packed again. Returns the number of tiles
+// uploaded.
+uint32_t mosaic_update(struct mosaic* mosaic, struct chip8_state** states);
+// Clears the window and draws every tile, call render_present to show it.
+void mosaic_draw(struct mosaic* mosaic);
+
+#endif
@@ -0,0 +1,187 @@
+#include "movie.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+
+#define FNV_OFFSET 0xCBF29CE484222325ull
+
+// FNV-1a over 8 byte words, a byte at a time is too slow to check every frame.
+static uint64_t fnv1a(uint64_t hash, const void* data, size_t size)
+{
+  const uint8_t* bytes = data;
+  size_t i = 0;
+  for (; i + 8 <= size; i += 8)
+  {
+    uint64_t word;
+    memcpy(&word, bytes + i, sizeof(word));
+    hash = (hash ^ word) * 0x100000001B3ull;
+  }
+  for (; i < size; ++i)
+  {
+    hash = (hash ^ bytes[i]) * 0x100000001B3ull;
+  }
+  return hash;
+}
+
+uint16_t scripted_keys(uint64_t frame, uint32_t* random, uint16_t keys)
+{
+  if (frame % 10 == 0)
+  {
+    // xorshift32
+    uint32_t x = *random;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *random = x;
+    keys = x % 17 == 16 ? 0 : 1 << (x % 17);
+  }
+  return keys;
+}
+
+uint64_t hash_file(const char* path)
+{
+  FILE* file = fopen(path, "rb");
+  if (file == NULL)
+  {
+    return 0;
+  }
+
+  uint64_t hash = FNV_OFFSET;
+  uint8_t buffer[4096];
+  size_t size;
+  while ((size = fread(buffer, 1, sizeof(buffer), file)) > 0)
+  {
+    hash = fnv1a(hash, buffer, size);
+  }
+  fclose(file);
+  return hash;
+}
+
+uint64_t hash_display(struct chip8_state* state)
+{
+  return fnv1a(FNV_OFFSET, state->display, sizeof(state->display));
+}
+
+uint64_t hash_state(struct chip8_state* state)
+{
+  // Everything but draw_flag and dirty_rows, which the frontend clears on
+  // its own schedule.
+  uint64_t hash = FNV_OFFSET;
+  for (int page = 0; page < 16; ++page)
+  {
+    const uint8_t* memory = state->shared_pages >> page & 1 ? state->shared_memory : state->memory;
+    hash = fnv1a(hash, &memory[page * CHIP8_PAGE_SIZE], CHIP8_PAGE_SIZE);
+  }
+  hash = fnv1a(hash, state->display, sizeof(state->display));
+  hash = fnv1a(hash, state->stack, sizeof(state->stack));
+  hash = fnv1a(hash, state->V, sizeof(state->V));
+  hash = fnv1a(hash, state->input, sizeof(state->input));
+  hash = fnv1a(hash, state->waiting_input, sizeof(state->waiting_input));
+  hash = fnv1a(hash, &state->I, sizeof(state->I));
+  hash = fnv1a(hash, &state->pc, sizeof(state->pc));
+  hash = fnv1a(hash, &state->sp, sizeof(state->sp));
+  hash = fnv1a(hash, &state->delay_timer, sizeof(state->delay_timer));
+  hash = fnv1a(hash, &state->sound_timer, sizeof(state->sound_timer));
+  hash = fnv1a(hash, &state->rng, sizeof(state->rng));
+  return hash;
+}
+
+struct movie* new_movie(const char* path, struct chip8_state* state, const char* program_path, uint32_t hash_interval)
+{
+  FILE* file = fopen(path, "wb");
+  if (file == NULL)
+  {
+    perror("Error");
+    return NULL;
+  }
+
+  struct movie* movie = calloc(1, sizeof(struct movie));
+  movie->file = file;
+  memcpy(movie->header.magic, MOVIE_MAGIC, 4);
+  movie->header.version = MOVIE_VERSION;
+  movie->header.seed = state->rng;
+  movie->header.quirks = 0;
+  movie->header.rom_hash = hash_file(program_path);
+  movie->header.hash_interval = hash_interval;
+  movie->header.frame_count = 0;
+
+  // Rewritten with the final frame count on close.
+  fwrite(&movie->header, sizeof(movie->header), 1, file);
+
+  return movie;
+}
+
+void movie_record_frame(struct movie* movie, uint16_t keys, uint16_t cycles, struct chip8_state* state)
+{
+  uint8_t flags = 0;
+  if (movie->header.hash_interval != 0 && movie->header.frame_count % movie->header.hash_interval == 0)
+  {
+    flags |= MOVIE_HASHED;
+  }
+
+  fwrite(&keys, sizeof(keys), 1, movie->file);
+  fwrite(&cycles, sizeof(cycles), 1, movie->file);
+  fwrite(&flags, sizeof(flags), 1, movie->file);
+  if (flags & MOVIE_HASHED)
+  {
+    uint64_t hashes[2] = { hash_display(state), hash_state(state) };
+    fwrite(hashes, sizeof(hashes), 1, movie->file);
+  }
+
+  movie->header.frame_count += 1;
+}
+
+struct movie* open_movie(const char* path)
+{
+  FILE* file = fopen(path, "rb");
+  if (file == NULL)
+  {
+    perror("Error");
+    return NULL;
+  }
+
+  struct movie* movie = calloc(1, sizeof(struct movie));
+  if (fread(&movie->header, sizeof(movie->header), 1, file) != 1
+    || memcmp(movie->header.magic, MOVIE_MAGIC, 4) != 0
+    || movie->header.version != MOVIE_VERSION)
+  {
+    printf("(ERROR) Not a movie: %s\n", path);
+    fclose(file);
+    free(movie);
+    return NULL;
+  }
+
+  movie->frames = calloc(movie->header.frame_count, sizeof(struct movie_frame));
+  for (uint32_t i = 0; i < movie->header.frame_count; ++i)
+  {
+    struct movie_frame* frame = &movie->frames[i];
+    if (fread(&frame->keys, sizeof(frame->keys), 1, file) != 1
+      || fread(&frame->cycles, sizeof(frame->cycles), 1, file) != 1
+      || fread(&frame->flags, sizeof(frame->flags), 1, file) != 1
+      || ((frame->flags & MOVIE_HASHED)
+        && (fread(&frame->display_hash, sizeof(frame->display_hash), 1, file) != 1
+        || fread(&frame->state_hash, sizeof(frame->state_hash), 1, file) != 1)))
+    {
+      printf("(ERROR) Movie truncated at frame %u\n", i);
+      movie->header.frame_count = i;
+      break;
+    }
+  }
+
+  fclose(file);
+  return movie;
+}
+
+void close_movie(struct movie* movie)
+{
+  // Only a recording still has its file open.
+  if (movie->file != NULL)
+  {
+    fseek(movie->file, 0, SEEK_SET);
+    fwrite(&movie->header, sizeof(movie->header), 1, movie->file);
+    fclose(movie->file);
+  }
+  free(movie->frames);
+  free(movie);
+}
@@ -0,0 +1,61 @@
+#ifndef MOVIE_H
+#define MOVIE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "chip8.h"
+
+#define MOVIE_MAGIC "C8MV"
+#define MOVIE_VERSION 2
+#define MOVIE_HASHED 0x01
+
+// A frame is the keys held from one timer tick to the next, the number of
+// instructions that ran in between, and optionally the hashes taken right
+// after the tick.
+struct movie_frame
+{
+  uint16_t keys;
+  uint16_t cycles;
+  uint8_t flags;
+  uint64_t display_hash;
+  uint64_t state_hash;
+};
+
+struct movie_header
+{
+  char magic[4];
+  uint32_t version;
+  uint32_t seed;
+  // There is no quirk profile yet, always 0.
+  uint32_t quirks;
+  uint64_t rom_hash;
+  uint32_t hash_interval;
+  uint32_t frame_count;
+};
+
+struct movie
+{
+  FILE* file;
+  struct movie_header header;
+  struct movie_frame* frames;
+};
+
+// Recording, the state must be the freshly loaded one.
+struct movie* new_movie(const char* path, struct chip8_state* state, const char* program_path, uint32_t hash_interval);
+void movie_record_frame(struct movie* movie, uint16_t keys, uint16_t cycles, struct chip8_state* state);
+
+// Playback, every frame is loaded up front.
+struct movie* open_movie(const char* path);
+
+void close_movie(struct movie* movie);
+
+// Keys for runs without a player: one random key, or none, held for 10
+// frames at a time. Start random at the seed XORed with 0x9E3779B9 and keys
+// at 0.
+uint16_t scripted_keys(uint64_t frame, uint32_t* random, uint16_t keys);
+
+uint64_t hash_file(const char* path);
+uint64_t hash_display(struct chip8_state* state);
+uint64_t hash_state(struct chip8_state* state);
+
+#endif
@@ -0,0 +1,196 @@
+#include "pool.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#define POOL_HUGE_PAGE_SIZE (2 << 20)
+
+static void map_states(struct chip8_pool* pool)
+{
+  uint64_t size = (uint64_t)pool->capacity * sizeof(struct chip8_state);
+  size = (size + POOL_HUGE_PAGE_SIZE - 1) / POOL_HUGE_PAGE_SIZE * POOL_HUGE_PAGE_SIZE;
+  pool->mapped_size = size;
+
+#ifndef _WIN32
+  // Anonymous pages come zeroed. Reserved huge pages first, then ask for
+  // transparent ones on a normal mapping.
+  void* states = MAP_FAILED;
+#ifdef MAP_HUGETLB
+  states = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+  pool->huge_pages = states != MAP_FAILED;
+#endif
+  if (states == MAP_FAILED)
+  {
+    states = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+#ifdef MADV_HUGEPAGE
+    if (states != MAP_FAILED && madvise(states, size, MADV_HUGEPAGE) == 0)
+    {
+      pool->huge_pages = 2;
+    }
+#endif
+  }
+  pool->states = states != MAP_FAILED ? states : NULL;
+#else
+  pool->states = aligned_alloc(64, size);
+  if (pool->states != NULL)
+  {
+    memset(pool->states, 0, size);
+  }
+#endif
+}
+
+struct chip8_pool* new_chip8_pool(uint32_t capacity)
+{
+  struct chip8_pool* pool = aligned_alloc(64, sizeof(struct chip8_pool));
+  memset(pool, 0, sizeof(struct chip8_pool));
+  pool->capacity = capacity;
+  chip8_init(&pool->template);
+
+  map_states(pool);
+  if (pool->states == NULL)
+  {
+    printf("(ERROR) Could not map %u states\n", capacity);
+    free(pool);
+    return NULL;
+  }
+
+  // Lowest index on top, so the first states handed out are adjacent.
+  pool->free = malloc(capacity * sizeof(uint32_t));
+  for (uint32_t i = 0; i < capacity; ++i)
+  {
+    pool->free[i] = capacity - 1 - i;
+  }
+  pool->free_count = capacity;
+  return pool;
+}
+
+void delete_chip8_pool(struct chip8_pool* pool)
+{
+#ifndef _WIN32
+  munmap(pool->states, pool->mapped_size);
+#else
+  free(pool->states);
+#endif
+  free(pool->shared_memory);
+  free(pool->free);
+  free(pool);
+}
+
+// Shared pages are left alone, the state reads them from the shared image
+// and never touches its own copy until it writes.
+static void copy_template(struct chip8_pool* pool, struct chip8_state* state)
+{
+  const struct chip8_state* template = &pool->template;
+  if (template->shared_pages == 0)
+  {
+    memcpy(state, template, sizeof(struct chip8_state));
+    return;
+  }
+
+  // Everything before memory, the display included.
+  memcpy(state, template, offsetof(struct chip8_state, memory));
+  for (int page = 0; page < 16; ++page)
+  {
+    if (!(template->shared_pages >> page & 1))
+    {
+      memcpy(&state->memory[page * CHIP8_PAGE_SIZE], &template->memory[page * CHIP8_PAGE_SIZE], CHIP8_PAGE_SIZE);
+    }
+  }
+}
+
+struct chip8_state* chip8_pool_acquire(struct chip8_pool* pool)
+{
+  if (pool->free_count == 0)
+  {
+    return NULL;
+  }
+  struct chip8_state* state = &pool->states[pool->free[--pool->free_count]];
+  copy_template(pool, state);
+  return state;
+}
+
+void chip8_pool_release(struct chip8_pool* pool, struct chip8_state* state)
+{
+  pool->free[pool->free_count++] = state - pool->states;
+}
+
+void chip8_pool_reset(struct chip8_pool* pool, struct chip8_state* state)
+{
+  copy_template(pool, state);
+}
+
+void chip8_pool_set_template(struct chip8_pool* pool, struct chip8_state* state)
+{
+  memcpy(&pool->template, state, sizeof(struct chip8_state));
+  chip8_own_memory(&pool->template);
+}
+
+int chip8_pool_share_template(struct chip8_pool* pool)
+{
+  if (pool->free_count != pool->capacity)
+  {
+    return -1;
+  }
+
+  struct chip8_state* template = &pool->template;
+  chip8_own_memory(template);
+  if (pool->shared_memory == NULL)
+  {
+    pool->shared_memory = aligned_alloc(64, sizeof(template->memory));
+  }
+  memcpy(pool->shared_memory, template->memory, sizeof(template->memory));
+  template->shared_memory = pool->shared_memory;
+  template->shared_pages = 0xFFFF;
+  return 0;
+}
+
+uint32_t chip8_pool_private_pages(struct chip8_pool* pool)
+{
+  uint8_t* idle = calloc(pool->capacity, 1);
+  for (uint32_t i = 0; i < pool->free_count; ++i)
+  {
+    idle[pool->free[i]] = 1;
+  }
+
+  uint32_t pages = 0;
+  for (uint32_t i = 0; i < pool->capacity; ++i)
+  {
+    uint16_t copied = pool->template.shared_pages & ~pool->states[i].shared_pages;
+    for (; !idle[i] && copied != 0; copied &= copied - 1)
+    {
+      pages += 1;
+    }
+  }
+  free(idle);
+  return pages;
+}
+
+uint64_t chip8_pool_resident_bytes(struct chip8_pool* pool)
+{
+#ifndef _WIN32
+  uint64_t page_size = sysconf(_SC_PAGESIZE);
+  uint64_t pages = pool->mapped_size / page_size;
+  unsigned char* resident = malloc(pages);
+  if (resident == NULL || mincore(pool->states, pool->mapped_size, resident) != 0)
+  {
+    free(resident);
+    return pool->mapped_size;
+  }
+
+  uint64_t bytes = 0;
+  for (uint64_t i = 0; i < pages; ++i)
+  {
+    bytes += (resident[i] & 1) * page_size;
+  }
+  free(resident);
+  return bytes;
+#else
+  return pool->mapped_size;
+#endif
+}
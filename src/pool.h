@@ -0,0 +1,50 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stdint.h>
+#include "chip8.h"
+
+// A fixed number of states in one mapping, huge pages when the system has
+// them. Acquiring and resetting a state copies the template, a freshly
+// made state unless set_template replaced it, so nothing is allocated or
+// read from disk once the pool exists. With share_template the states also
+// read the template's memory from one copy and keep only the pages they
+// write, see chip8_state.shared_pages. Every slot still holds a whole
+// chip8_state, memory included, so sharing saves copying and touching
+// memory but not mapping it.
+struct chip8_pool
+{
+  struct chip8_state template;
+  struct chip8_state* states;
+  uint32_t capacity;
+  uint64_t mapped_size;
+  // 1 for reserved huge pages, 2 for transparent ones, 0 for neither.
+  int huge_pages;
+  // The template's memory as states read it, NULL until share_template.
+  uint8_t* shared_memory;
+
+  uint32_t* free;
+  uint32_t free_count;
+};
+
+struct chip8_pool* new_chip8_pool(uint32_t capacity);
+void delete_chip8_pool(struct chip8_pool* pool);
+
+// NULL when every state is in use.
+struct chip8_state* chip8_pool_acquire(struct chip8_pool* pool);
+void chip8_pool_release(struct chip8_pool* pool, struct chip8_state* state);
+// Puts the state back to the template.
+void chip8_pool_reset(struct chip8_pool* pool, struct chip8_state* state);
+// Later acquires and resets start from a copy of state, for example one
+// with the ROM already loaded and seeded. The new template owns its memory.
+void chip8_pool_set_template(struct chip8_pool* pool, struct chip8_state* state);
+// Later acquires and resets share the template's memory instead of copying
+// it. -1 while states are acquired, since they may read the old image.
+int chip8_pool_share_template(struct chip8_pool* pool);
+// Pages the acquired states have copied out of the shared memory so far.
+uint32_t chip8_pool_private_pages(struct chip8_pool* pool);
+// Bytes of the mapping the system holds in memory, mapped_size where that
+// cannot be asked.
+uint64_t chip8_pool_resident_bytes(struct chip8_pool* pool);
+
+#endif
@@ -0,0 +1,128 @@
+#include "profiler.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+
+struct profiler* new_profiler(uint32_t interval)
+{
+  struct profiler* profiler = malloc(sizeof(struct profiler));
+
+  profiler->interval = interval;
+  profiler->countdown = interval;
+  profiler->pending = 0;
+  profiler->capacity = 256;
+  profiler->used = 0;
+  profiler->samples = 0;
+  profiler->stacks = calloc(profiler->capacity, sizeof(struct profiler_stack));
+
+  return profiler;
+}
+
+void delete_profiler(struct profiler* profiler)
+{
+  free(profiler->stacks);
+  free(profiler);
+}
+
+static uint32_t hash_frames(uint16_t* frames, uint8_t depth)
+{
+  // FNV-1a
+  uint32_t hash = 2166136261u;
+  for (int i = 0; i < depth; ++i)
+  {
+    hash = (hash ^ (frames[i] & 0xFF)) * 16777619u;
+    hash = (hash ^ (frames[i] >> 8)) * 16777619u;
+  }
+  return hash;
+}
+
+static struct profiler_stack* find_slot(struct profiler_stack* stacks, uint32_t capacity, uint16_t* frames, uint8_t depth)
+{
+  uint32_t i = hash_frames(frames, depth) & (capacity - 1);
+  while (stacks[i].depth != 0)
+  {
+    if (stacks[i].depth == depth && memcmp(stacks[i].frames, frames, depth * sizeof(uint16_t)) == 0)
+    {
+      break;
+    }
+    i = (i + 1) & (capacity - 1);
+  }
+  return &stacks[i];
+}
+
+static void grow(struct profiler* profiler)
+{
+  uint32_t capacity = profiler->capacity * 2;
+  struct profiler_stack* stacks = calloc(capacity, sizeof(struct profiler_stack));
+
+  for (uint32_t i = 0; i < profiler->capacity; ++i)
+  {
+    struct profiler_stack* old = &profiler->stacks[i];
+    if (old->depth != 0)
+    {
+      *find_slot(stacks, capacity, old->frames, old->depth) = *old;
+    }
+  }
+
+  free(profiler->stacks);
+  profiler->stacks = stacks;
+  profiler->capacity = capacity;
+}
+
+void profiler_sample(struct profiler* profiler, struct chip8_state* state)
+{
+  profiler->pending = 0;
+  profiler->countdown = profiler->interval;
+
+  // The stack only holds return addresses, the subroutine entry comes from
+  // the CALL instruction just before each one.
+  uint16_t frames[17];
+  uint8_t depth = 0;
+  frames[depth++] = 0x200;
+
+  uint8_t sp = state->sp < 16 ? state->sp : 16;
+  for (int i = 0; i < sp; ++i)
+  {
+    uint16_t call = (state->stack[i] - 2) & 0x0FFF;
+    uint16_t opcode = chip8_read(state, call) << 8 | chip8_read(state, (call + 1) & 0x0FFF);
+    frames[depth++] = (opcode & 0xF000) == 0x2000 ? opcode & 0x0FFF : call;
+  }
+
+  if ((profiler->used + 1) * 4 > profiler->capacity * 3)
+  {
+    grow(profiler);
+  }
+
+  struct profiler_stack* slot = find_slot(profiler->stacks, profiler->capacity, frames, depth);
+  if (slot->depth == 0)
+  {
+    memcpy(slot->frames, frames, depth * sizeof(uint16_t));
+    slot->depth = depth;
+    profiler->used += 1;
+  }
+  slot->count += 1;
+  profiler->samples += 1;
+}
+
+int profiler_write_folded(struct profiler* profiler, FILE* file)
+{
+  // One "main;sub_2A4;sub_31C <count>" line per unique chain, as read by flamegraph.pl.
+  for (uint32_t i = 0; i < profiler->capacity; ++i)
+  {
+    struct profiler_stack* stack = &profiler->stacks[i];
+    if (stack->depth == 0)
+    {
+      continue;
+    }
+
+    fputs("main", file);
+    for (int j = 1; j < stack->depth; ++j)
+    {
+      fprintf(file, ";sub_%03X", stack->frames[j]);
+    }
+    fprintf(file, " %llu\n", (unsigned long long)stack->count);
+  }
+
+  return ferror(file) ? -1 : 0;
+}
@@ -0,0 +1,51 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <signal.h>
+#include "chip8.h"
+
+// One aggregated call chain. frames[0] is the outermost subroutine entry.
+struct profiler_stack
+{
+  uint16_t frames[17];
+  uint8_t depth;
+  uint64_t count;
+};
+
+struct profiler
+{
+  uint32_t interval;
+  uint32_t countdown;
+  volatile sig_atomic_t pending;
+
+  struct profiler_stack* stacks;
+  uint32_t capacity;
+  uint32_t used;
+  uint64_t samples;
+};
+
+// interval is the number of instructions between samples, 0 samples only on request.
+struct profiler* new_profiler(uint32_t interval);
+void delete_profiler(struct profiler* profiler);
+
+void profiler_sample(struct profiler* profiler, struct chip8_state* state);
+int profiler_write_folded(struct profiler* profiler, FILE* file);
+
+// Safe to call from a signal handler, the sample is taken at the next tick.
+static inline void profiler_request_sample(struct profiler* profiler)
+{
+  profiler->pending = 1;
+}
+
+// Call once per executed instruction.
+static inline void profiler_tick(struct profiler* profiler, struct chip8_state* state)
+{
+  if (profiler->pending || (profiler->interval != 0 && --profiler->countdown == 0))
+  {
+    profiler_sample(profiler, state);
+  }
+}
+
+#endif
@@ -1,9 +1,19 @@
 #include "renderer.h"
+#include "font.h"
 
+#include <stdlib.h>
 #include <string.h>
-#include <stb_image.h>
-// #include <stdio.h>
+#include <stdarg.h>
+#include <time.h>
+#include <stdio.h>
 
+#ifndef _WIN32
+#include <errno.h>
+#include <sys/stat.h>
+#endif
+
+
+#define WINDOW_TITLE "Chip8 Emulator"
 
 static struct render_data data;
 
@@ -17,13 +27,44 @@ const char *vertex_shader_src = "#version 330 core\n"
   "   uv = a_uv;\n"
   "}\0";
 
+// The display arrives one bit per pixel, 8 pixels to a texel.
 const char *fragment_shader_src = "#version 330 core\n"
   "in vec2 uv;\n"
-  "uniform sampler2D u_tex;\n"
+  "uniform usampler2D u_tex;\n"
+  "uniform vec4 u_palette[2];\n"
   "out vec4 color;\n"
   "void main()\n"
   "{\n"
-  "   color = texture(u_tex, uv);\n"
+  "   ivec2 pixel = min(ivec2(uv * vec2(64.0, 32.0)), ivec2(63, 31));\n"
+  "   uint bits = texelFetch(u_tex, ivec2(pixel.x >> 3, pixel.y), 0).r;\n"
+  "   color = u_palette[(bits >> uint(pixel.x & 7)) & 1u];\n"
+  "}\n\0";
+
+// One instance per text cell, the quad corners come from gl_VertexID and
+// the cell from gl_InstanceID, so the only per instance data is the
+// character. The atlas holds ASCII 32 to 127 in 16 columns and 6 rows.
+const char *debug_vertex_shader_src = "#version 330 core\n"
+  "layout (location = 0) in uint a_char;\n"
+  "uniform vec2 u_origin;\n"
+  "uniform vec2 u_cell;\n"
+  "uniform int u_columns;\n"
+  "out vec2 uv;\n"
+  "void main()\n"
+  "{\n"
+  "   vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1);\n"
+  "   vec2 cell = vec2(gl_InstanceID % u_columns, gl_InstanceID / u_columns);\n"
+  "   gl_Position = vec4(u_origin + vec2(cell.x + corner.x, -(cell.y + corner.y)) * u_cell, 0.0, 1.0);\n"
+  "   int glyph = int(a_char) - 32;\n"
+  "   uv = (vec2(glyph % 16, glyph / 16) + corner) / vec2(16.0, 6.0);\n"
+  "}\0";
+
+const char *debug_fragment_shader_src = "#version 330 core\n"
+  "in vec2 uv;\n"
+  "uniform sampler2D u_font;\n"
+  "out vec4 color;\n"
+  "void main()\n"
+  "{\n"
+  "   color = vec4(1.0, 1.0, 1.0, texture(u_font, uv).r);\n"
   "}\n\0";
 
 float vertices[] = {
@@ -43,67 +84,275 @@ int keys[] = {
   GLFW_KEY_Z, GLFW_KEY_X, GLFW_KEY_C, GLFW_KEY_V
 };
 
-void init_renderer()
+// Key events are timestamped here, as soon as GLFW hands them over.
+static void on_key(GLFWwindow* window, int key, int scancode, int action, int mods)
 {
-  glfwInit();
-  glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-  glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
-  glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-
-  #ifdef __APPLE__
-    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
-  #endif
+  if (action == GLFW_REPEAT)
+  {
+    return;
+  }
 
-  data.window = glfwCreateWindow(64 * 18, 32 * 12, "Chip8 Emulator", NULL, NULL);
-  glfwMakeContextCurrent(data.window);
-  glfwSetWindowAspectRatio(data.window, 3, 1);
-  gladLoadGL(glfwGetProcAddress);
-  // glViewport(0, 0, 64 * 16, 32 * 16);
+  for (int i = 0; i < sizeof(keys) / sizeof(int); ++i)
+  {
+    if (keys[i] == key)
+    {
+      data.pressed = action == GLFW_PRESS ? data.pressed | 1 << i : data.pressed & ~(1 << i);
+      if (data.input != NULL)
+      {
+        struct timespec time;
+        timespec_get(&time, TIME_UTC);
+        input_queue_push(data.input, time.tv_sec * 1000000000ull + time.tv_nsec, i, action == GLFW_PRESS);
+      }
+      return;
+    }
+  }
+}
 
-  // Create Shader Program
+static unsigned int compile_shader(GLenum type, const char* source)
+{
   int success = 0;
   char info[512];
 
-  unsigned int vertex_shader = glCreateShader(GL_VERTEX_SHADER);
-  glShaderSource(vertex_shader, 1, &vertex_shader_src, NULL);
-  glCompileShader(vertex_shader);
+  unsigned int shader = glCreateShader(type);
+  glShaderSource(shader, 1, &source, NULL);
+  glCompileShader(shader);
 
-  glGetShaderiv(vertex_shader, GL_COMPILE_STATUS, &success);
+  glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
   if (!success) {
-      glGetShaderInfoLog(data.shader, 512, NULL, info);
-      printf("ERROR::SHADER::VERTEX::COMPILING_FAILED %s\n", info);
+      glGetShaderInfoLog(shader, 512, NULL, info);
+      printf("ERROR::SHADER::%s::COMPILING_FAILED %s\n", type == GL_VERTEX_SHADER ? "VERTEX" : "FRAGMENT", info);
   }
+  return shader;
+}
 
-  unsigned int fragment_shader = glCreateShader(GL_FRAGMENT_SHADER);
-  glShaderSource(fragment_shader, 1, &fragment_shader_src, NULL);
-  glCompileShader(fragment_shader);
+static unsigned int link_program(const char* vertex_source, const char* fragment_source)
+{
+  int success = 0;
+  char info[512];
 
-  glGetShaderiv(fragment_shader, GL_COMPILE_STATUS, &success);
-  if (!success) {
-      glGetShaderInfoLog(data.shader, 512, NULL, info);
-      printf("ERROR::SHADER::FRAGMENT::COMPILING_FAILED %s\n", info);
-  }
+  unsigned int vertex_shader = compile_shader(GL_VERTEX_SHADER, vertex_source);
+  unsigned int fragment_shader = compile_shader(GL_FRAGMENT_SHADER, fragment_source);
 
-  data.shader = glCreateProgram();
-  glAttachShader(data.shader, vertex_shader);
-  glAttachShader(data.shader, fragment_shader);
-  glLinkProgram(data.shader);
+  unsigned int program = glCreateProgram();
+  glAttachShader(program, vertex_shader);
+  glAttachShader(program, fragment_shader);
+  if (GLAD_GL_VERSION_4_1)
+  {
+    glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+  }
+  glLinkProgram(program);
 
   glDeleteShader(vertex_shader);
   glDeleteShader(fragment_shader);
 
-
-  glGetProgramiv(data.shader, GL_LINK_STATUS, &success);
+  glGetProgramiv(program, GL_LINK_STATUS, &success);
   if (!success) {
-      glGetProgramInfoLog(data.shader, 512, NULL, info);
+      glGetProgramInfoLog(program, 512, NULL, info);
       printf("ERROR::SHADER::PROGRAM::LINKING_FAILED %s\n", info);
   }
+  return program;
+}
 
+static uint64_t hash_string(uint64_t hash, const char* string)
+{
+  // FNV-1a
+  for (; *string != '\0'; ++string)
+  {
+    hash = (hash ^ (uint8_t)*string) * 0x100000001B3ull;
+  }
+  return hash;
+}
+
+// Linked programs are kept in the user's cache directory, one file per
+// program named after a hash of the driver strings and the sources. A new
+// driver gets new names, and a binary the driver rejects anyway is relinked
+// and written again.
+static void program_cache_path(char* path, size_t size, const char* vertex_source, const char* fragment_source)
+{
+  uint64_t hash = 0xCBF29CE484222325ull;
+  hash = hash_string(hash, (const char*)glGetString(GL_VENDOR));
+  hash = hash_string(hash, (const char*)glGetString(GL_RENDERER));
+  hash = hash_string(hash, (const char*)glGetString(GL_VERSION));
+  hash = hash_string(hash, vertex_source);
+  hash = hash_string(hash, fragment_source);
+
+  const char* cache = getenv("XDG_CACHE_HOME");
+  const char* home = getenv("HOME");
+  if (cache != NULL)
+  {
+    snprintf(path, size, "%s/chip8-%016llx.program", cache, (unsigned long long)hash);
+  }
+  else if (home != NULL)
+  {
+    snprintf(path, size, "%s/.cache/chip8-%016llx.program", home, (unsigned long long)hash);
+  }
+  else
+  {
+    snprintf(path, size, "chip8-%016llx.program", (unsigned long long)hash);
+  }
+}
+
+static unsigned int load_cached_program(const char* path)
+{
+  FILE* file = fopen(path, "rb");
+  if (file == NULL)
+  {
+    return 0;
+  }
+
+  unsigned int program = 0;
+  uint32_t format;
+  uint32_t length;
+  if (fread(&format, sizeof(format), 1, file) == 1 && fread(&length, sizeof(length), 1, file) == 1)
+  {
+    void* binary = malloc(length);
+    if (binary != NULL && fread(binary, 1, length, file) == length)
+    {
+      int success = 0;
+      program = glCreateProgram();
+      glProgramBinary(program, format, binary, length);
+      glGetProgramiv(program, GL_LINK_STATUS, &success);
+      if (!success)
+      {
+        glDeleteProgram(program);
+        program = 0;
+      }
+    }
+    free(binary);
+  }
+
+  fclose(file);
+  return program;
+}
+
+// Every directory above path, like mkdir -p. A fresh home has no ~/.cache.
+static void create_parent_directories(const char* path)
+{
+#ifndef _WIN32
+  char directory[1024];
+  snprintf(directory, sizeof(directory), "%s", path);
+  for (char* slash = strchr(directory + 1, '/'); slash != NULL; slash = strchr(slash + 1, '/'))
+  {
+    *slash = '\0';
+    if (mkdir(directory, 0755) != 0 && errno != EEXIST)
+    {
+      return;
+    }
+    *slash = '/';
+  }
+#else
+  (void)path;
+#endif
+}
+
+static int cache_failed;
+
+static void save_cached_program(const char* path, unsigned int program)
+{
+  int length = 0;
+  glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+  if (length <= 0)
+  {
+    return;
+  }
+
+  void* binary = malloc(length);
+  GLenum format;
+  glGetProgramBinary(program, length, NULL, &format, binary);
+
+  create_parent_directories(path);
+  FILE* file = fopen(path, "wb");
+  if (file != NULL)
+  {
+    uint32_t header[2] = { format, length };
+    fwrite(header, sizeof(header), 1, file);
+    fwrite(binary, 1, length, file);
+    fclose(file);
+  }
+  else if (!cache_failed)
+  {
+    // Once, every program links again on the next start anyway.
+    cache_failed = 1;
+    perror("Error");
+    printf("(ERROR) Could not write the program cache %s\n", path);
+  }
+  free(binary);
+}
+
+unsigned int create_program(const char* vertex_source, const char* fragment_source)
+{
+  int formats = 0;
+  if (GLAD_GL_VERSION_4_1)
+  {
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+  }
+  if (formats == 0)
+  {
+    return link_program(vertex_source, fragment_source);
+  }
+
+  char path[1024];
+  program_cache_path(path, sizeof(path), vertex_source, fragment_source);
+  unsigned int program = load_cached_program(path);
+  if (program != 0)
+  {
+    data.startup.cached_programs += 1;
+    return program;
+  }
+
+  program = link_program(vertex_source, fragment_source);
+  save_cached_program(path, program);
+  return program;
+}
+
+static double now()
+{
+  struct timespec time;
+  timespec_get(&time, TIME_UTC);
+  return time.tv_sec + time.tv_nsec * 0.000000001;
+}
+
+// The window contents are gone, the next frame is presented even when the
+// display did not change.
+static void on_damage(GLFWwindow* window)
+{
+  data.force_present = 1;
+}
+
+static void on_resize(GLFWwindow* window, int width, int height)
+{
+  data.force_present = 1;
+}
+
+void init_renderer()
+{
+  double start = now();
+  glfwInit();
+  glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+  glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+  glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+
+  #ifdef __APPLE__
+    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+  #endif
+
+  data.window = glfwCreateWindow(64 * 18, 32 * 12, WINDOW_TITLE, NULL, NULL);
+  glfwMakeContextCurrent(data.window);
+  glfwSetWindowAspectRatio(data.window, 3, 1);
+  glfwSetKeyCallback(data.window, on_key);
+  glfwSetWindowRefreshCallback(data.window, on_damage);
+  glfwSetFramebufferSizeCallback(data.window, on_resize);
+  gladLoadGL(glfwGetProcAddress);
+  // glViewport(0, 0, 64 * 16, 32 * 16);
+  double context = now();
+  data.startup.context = (context - start) * 1000.0;
+
+  data.shader = create_program(vertex_shader_src, fragment_shader_src);
   glUseProgram(data.shader);
 
 
   // Create Texture
-  for (int i = 0; i < CHIP8_SCREEN_WIDTH * CHIP8_SCREEN_HEIGHT * 3; ++i)
+  for (int i = 0; i < CHIP8_PACKED_DISPLAY_SIZE; ++i)
   {
     data.texture_data[i] = 0;
   }
@@ -112,7 +361,8 @@ void init_renderer()
   glBindTexture(GL_TEXTURE_2D, data.texture);
   glEnable(GL_TEXTURE_2D);
 
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, CHIP8_SCREEN_WIDTH, CHIP8_SCREEN_HEIGHT, 0, GL_RGB, GL_UNSIGNED_BYTE, (void*)data.texture_data);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_R8UI, CHIP8_SCREEN_WIDTH / 8, CHIP8_SCREEN_HEIGHT, 0, GL_RED_INTEGER, GL_UNSIGNED_BYTE, (void*)data.texture_data);
 
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
@@ -130,30 +380,55 @@ void init_renderer()
   glEnableVertexAttribArray(1);
   glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void*)(sizeof(float) * 2));
 
+  // Pixel buffers, persistently mapped when the context has GL 4.4
+  glGenBuffers(RENDER_PBO_COUNT, data.pbo);
+  data.persistent_pbo = GLAD_GL_VERSION_4_4;
+  for (int i = 0; i < RENDER_PBO_COUNT; ++i)
+  {
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, data.pbo[i]);
+    if (data.persistent_pbo)
+    {
+      GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+      glBufferStorage(GL_PIXEL_UNPACK_BUFFER, CHIP8_PACKED_DISPLAY_SIZE, NULL, flags);
+      data.pbo_mapped[i] = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, CHIP8_PACKED_DISPLAY_SIZE, flags);
+    }
+    else
+    {
+      glBufferData(GL_PIXEL_UNPACK_BUFFER, CHIP8_PACKED_DISPLAY_SIZE, NULL, GL_STREAM_DRAW);
+    }
+    data.pbo_fence[i] = NULL;
+  }
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+  data.pbo_index = 0;
+  data.use_pbo = 1;
+
   unsigned int u_texture = glGetUniformLocation(data.shader, "u_tex");
   glUniform1i(u_texture, 0);
 
+  float palette[] = {
+    0.0f, 0.0f, 0.0f, 1.0f, // off
+    1.0f, 1.0f, 1.0f, 1.0f, // on
+  };
+  unsigned int u_palette = glGetUniformLocation(data.shader, "u_palette");
+  glUniform4fv(u_palette, 2, palette);
 
-  // Debug
-  int width;
-  int height;
-  int channels;
-  unsigned char* texture_data = stbi_load("../resources/font.png", &width, &height, &channels, 4);
-  if (texture_data == NULL)
+
+  // Debug, the font is expanded from one bit per pixel into an 8 bit atlas.
+  uint8_t atlas[6 * FONT_GLYPH_SIZE][16 * 8];
+  for (int glyph = 0; glyph < FONT_GLYPHS; ++glyph)
   {
-    printf("Failed to load font texture.\n");
+    for (int y = 0; y < FONT_GLYPH_SIZE; ++y)
+    {
+      for (int x = 0; x < 8; ++x)
+      {
+        atlas[glyph / 16 * FONT_GLYPH_SIZE + y][glyph % 16 * 8 + x] = (font_glyphs[glyph][y] >> x & 1) * 255;
+      }
+    }
   }
 
   glGenTextures(1, &data.debug_texture);
   glBindTexture(GL_TEXTURE_2D, data.debug_texture);
-  glTexImage2D(
-    GL_TEXTURE_2D, 0, GL_RGBA,
-    (unsigned int)width, (unsigned int)height,
-    0, GL_RGBA, GL_UNSIGNED_BYTE,
-    texture_data
-  );
-
-  stbi_image_free(texture_data);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, 16 * 8, 6 * FONT_GLYPH_SIZE, 0, GL_RED, GL_UNSIGNED_BYTE, atlas);
 
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
@@ -162,25 +437,28 @@ void init_renderer()
   glEnable(GL_BLEND);
   glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
+  data.debug_shader = create_program(debug_vertex_shader_src, debug_fragment_shader_src);
+  glUseProgram(data.debug_shader);
+  glUniform1i(glGetUniformLocation(data.debug_shader, "u_font"), 0);
+  glUniform1i(glGetUniformLocation(data.debug_shader, "u_columns"), DEBUG_COLUMNS);
+  // The panel is the right third of the window, next to the display quad,
+  // with rows a twelfth of the window's half height from the top down.
+  glUniform2f(glGetUniformLocation(data.debug_shader, "u_origin"), (1.0f / 3.0f) + (2.0f / 3.0f) / (DEBUG_COLUMNS + 2), 1.0f - 1.0f / 12);
+  glUniform2f(glGetUniformLocation(data.debug_shader, "u_cell"), (2.0f / 3.0f) / (DEBUG_COLUMNS + 2), 1.0f / 12);
+  glUseProgram(data.shader);
+
+  memset(data.debug_text, ' ', sizeof(data.debug_text));
   glGenVertexArrays(1, &data.debug_vao);
   glBindVertexArray(data.debug_vao);
   glGenBuffers(1, &data.debug_vbo);
   glBindBuffer(GL_ARRAY_BUFFER, data.debug_vbo);
+  glBufferData(GL_ARRAY_BUFFER, sizeof(data.debug_text), data.debug_text, GL_DYNAMIC_DRAW);
+  glEnableVertexAttribArray(0);
+  glVertexAttribIPointer(0, 1, GL_UNSIGNED_BYTE, 1, (void*)0);
+  glVertexAttribDivisor(0, 1);
+  glBindVertexArray(data.vao);
 
-  for (int i = 0, j = 0; i < sizeof(data.debug_indices) / sizeof(unsigned int); i += 6, j += 4)
-  {
-    data.debug_indices[i + 0] = j + 0;
-    data.debug_indices[i + 2] = j + 1;
-    data.debug_indices[i + 1] = j + 2;
-
-    data.debug_indices[i + 3] = j + 2;
-    data.debug_indices[i + 4] = j + 3;
-    data.debug_indices[i + 5] = j + 0;
-  }
-
-  glGenBuffers(1, &data.debug_ebo);
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, data.debug_ebo);
-  glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(data.debug_indices), data.debug_indices, GL_STATIC_DRAW);
+  data.startup.setup = (now() - context) * 1000.0;
 }
 
 int should_close()
@@ -188,47 +466,244 @@ int should_close()
   return glfwWindowShouldClose(data.window);
 }
 
-void poll_window(struct chip8_state* state)
+// Returns the pressed keys, bit i is key i.
+uint16_t poll_window()
 {
   glfwPollEvents();
-  
-  for (int i = 0; i < sizeof(keys) / sizeof(int); ++i)
+  return data.pressed;
+}
+
+// Like poll_window, but sleeps up to timeout seconds until an event arrives.
+uint16_t wait_window(double timeout)
+{
+  glfwWaitEventsTimeout(timeout);
+  return data.pressed;
+}
+
+void set_input_queue(struct input_queue* queue)
+{
+  data.input = queue;
+}
+
+const struct render_startup* render_startup_times()
+{
+  return &data.startup;
+}
+
+void render_set_status(const char* status)
+{
+  if (status == NULL)
+  {
+    glfwSetWindowTitle(data.window, WINDOW_TITLE);
+    return;
+  }
+
+  char title[256];
+  snprintf(title, sizeof(title), "%s - %s", WINDOW_TITLE, status);
+  glfwSetWindowTitle(data.window, title);
+}
+
+void render_use_pbo(int enable)
+{
+  data.use_pbo = enable;
+}
+
+// Rows of packed that differ from what the texture holds.
+static uint32_t changed_rows(const uint8_t* packed)
+{
+  uint32_t rows = 0;
+  for (int y = 0; y < CHIP8_SCREEN_HEIGHT; ++y)
+  {
+    if (memcmp(&packed[y * 8], &data.uploaded[y * 8], 8) != 0)
+    {
+      rows |= 1u << y;
+    }
+  }
+  return rows;
+}
+
+// Each run of neighbouring rows is one glTexSubImage2D, source is the packed
+// display or, with a pixel buffer bound, NULL for offsets into it.
+static void upload_rows(const uint8_t* source, uint32_t rows)
+{
+  for (int y = 0; y < CHIP8_SCREEN_HEIGHT; ++y)
   {
-    if (glfwGetKey(data.window, keys[i]) == GLFW_PRESS)
+    if ((rows >> y & 1) == 0)
     {
-      state->input[i] = 1;
+      continue;
     }
-    if (glfwGetKey(data.window, keys[i]) == GLFW_RELEASE)
+    int first = y;
+    while (y + 1 < CHIP8_SCREEN_HEIGHT && (rows >> (y + 1) & 1) != 0)
     {
-      state->input[i] = 0;
+      y += 1;
     }
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, first, CHIP8_SCREEN_WIDTH / 8, y - first + 1, GL_RED_INTEGER, GL_UNSIGNED_BYTE,
+      (void*)((uintptr_t)source + first * 8));
   }
-
 }
 
-void render_display(struct chip8_state* state)
+// Returns 0 when the upload had to be skipped.
+static int upload_display(const uint8_t* packed, uint32_t rows)
 {
-  glClearColor(0.5f, 0.5f, 0.6f, 1.0f);
-  glClear(GL_COLOR_BUFFER_BIT);
+  if (!data.use_pbo)
+  {
+    upload_rows(packed, rows);
+    return 1;
+  }
 
-  for (int y = 0; y < 32; ++y)
+  unsigned int i = data.pbo_index;
+
+  // Never wait on the driver, if the oldest buffer is somehow still being
+  // read keep showing the last frame and catch up on the next draw.
+  if (data.pbo_fence[i] != NULL)
   {
-    for (int x = 0; x < 64; ++x)
+    GLenum status = glClientWaitSync(data.pbo_fence[i], 0, 0);
+    if (status == GL_TIMEOUT_EXPIRED)
     {
-      data.texture_data[((y * 64 + x) * 3) + 0] = state->display[y * 64 + x] * 255; // R
-      data.texture_data[((y * 64 + x) * 3) + 1] = state->display[y * 64 + x] * 255; // G
-      data.texture_data[((y * 64 + x) * 3) + 2] = state->display[y * 64 + x] * 255; // B
+      data.skipped_uploads += 1;
+      return 0;
     }
+    glDeleteSync(data.pbo_fence[i]);
+    data.pbo_fence[i] = NULL;
   }
 
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, data.pbo[i]);
+  if (data.persistent_pbo)
+  {
+    memcpy(data.pbo_mapped[i], packed, CHIP8_PACKED_DISPLAY_SIZE);
+  }
+  else
+  {
+    // The fence above already guarantees the buffer is idle.
+    uint8_t* mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, CHIP8_PACKED_DISPLAY_SIZE,
+      GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+    memcpy(mapped, packed, CHIP8_PACKED_DISPLAY_SIZE);
+    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+  }
+
+  upload_rows(NULL, rows);
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+  data.pbo_fence[i] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  data.pbo_index = (i + 1) % RENDER_PBO_COUNT;
+  return 1;
+}
+
+int render_frame(const uint8_t* packed)
+{
+  // Nothing to show when the pixels are the ones already on screen.
+  uint32_t rows = changed_rows(packed);
+  if (rows == 0 && !data.debug_changed && !data.force_present)
+  {
+    data.skipped_presents += 1;
+    return 0;
+  }
+
+  glClearColor(0.5f, 0.5f, 0.6f, 1.0f);
+  glClear(GL_COLOR_BUFFER_BIT);
+
+  glUseProgram(data.shader);
   glBindVertexArray(data.vao);
   glBindTexture(GL_TEXTURE_2D, data.texture);
-  glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, CHIP8_SCREEN_WIDTH, CHIP8_SCREEN_HEIGHT, GL_RGB, GL_UNSIGNED_BYTE, (void*)data.texture_data);
+  if (rows != 0 && upload_display(packed, rows))
+  {
+    memcpy(data.uploaded, packed, CHIP8_PACKED_DISPLAY_SIZE);
+  }
   glDrawArrays(GL_TRIANGLES, 0, 6);
+
+  if (data.show_debug)
+  {
+    glUseProgram(data.debug_shader);
+    glBindVertexArray(data.debug_vao);
+    glBindTexture(GL_TEXTURE_2D, data.debug_texture);
+    glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, DEBUG_COLUMNS * DEBUG_ROWS);
+    glUseProgram(data.shader);
+  }
+
   glfwSwapBuffers(data.window);
+  data.debug_changed = 0;
+  data.force_present = 0;
+  return 1;
 }
 
-void render_debug(struct chip8_state* state)
+void render_present()
 {
+  glfwSwapBuffers(data.window);
+}
+
+int render_display(struct chip8_state* state)
+{
+  chip8_pack_display(state, data.texture_data);
+  return render_frame(data.texture_data);
+}
+
+static void print_row(char text[DEBUG_ROWS][DEBUG_COLUMNS], int row, const char* format, ...)
+{
+  char line[DEBUG_COLUMNS + 1];
+  va_list args;
+  va_start(args, format);
+  int length = vsnprintf(line, sizeof(line), format, args);
+  va_end(args);
+
+  length = length < DEBUG_COLUMNS ? length : DEBUG_COLUMNS;
+  memcpy(text[row], line, length);
+}
+
+void render_debug(struct debug_stats* stats)
+{
+  if (stats == NULL)
+  {
+    data.debug_changed |= data.show_debug;
+    data.show_debug = 0;
+    return;
+  }
+  data.debug_changed |= !data.show_debug;
+  data.show_debug = 1;
+
+  char text[DEBUG_ROWS][DEBUG_COLUMNS];
+  memset(text, ' ', sizeof(text));
+  print_row(text, 0, "PC %03X  I %03X  SP %X", stats->pc, stats->I, stats->sp);
+  print_row(text, 1, "DT %02X  ST %02X", stats->delay_timer, stats->sound_timer);
+  for (int i = 0; i < 4; ++i)
+  {
+    uint8_t* V = &stats->V[i * 4];
+    print_row(text, 3 + i, "V%X %02X V%X %02X V%X %02X V%X %02X",
+      i * 4, V[0], i * 4 + 1, V[1], i * 4 + 2, V[2], i * 4 + 3, V[3]);
+  }
+  print_row(text, 8, "MIPS %.4f", stats->mips);
+  print_row(text, 9, "FRAME %.2f ms", stats->frame_time);
+  if (stats->show_latency)
+  {
+    print_row(text, 11, "%-8s %6s %6s", "LAT ms", "p50", "p99");
+    for (int stage = 0; stage < LATENCY_STAGE_COUNT; ++stage)
+    {
+      print_row(text, 12 + stage, "%-8s %6.2f %6.2f", latency_stage_labels[stage], stats->latency_p50[stage],
+        stats->latency_p99[stage]);
+    }
+  }
+
+  // Only the changed span of each row is sent to the instance buffer.
+  glBindBuffer(GL_ARRAY_BUFFER, data.debug_vbo);
+  for (int row = 0; row < DEBUG_ROWS; ++row)
+  {
+    int first = 0;
+    int last = DEBUG_COLUMNS - 1;
+    while (first <= last && text[row][first] == data.debug_text[row][first])
+    {
+      first += 1;
+    }
+    while (last > first && text[row][last] == data.debug_text[row][last])
+    {
+      last -= 1;
+    }
+    if (first > last)
+    {
+      continue;
+    }
 
+    memcpy(&data.debug_text[row][first], &text[row][first], last - first + 1);
+    data.debug_changed = 1;
+    glBufferSubData(GL_ARRAY_BUFFER, row * DEBUG_COLUMNS + first, last - first + 1, &data.debug_text[row][first]);
+  }
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
 }
\ No newline at end of file
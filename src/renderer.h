@@ -5,36 +5,97 @@
 #include <GLFW/glfw3.h>
 #include <stdint.h>
 #include "chip8.h"
+#include "input_queue.h"
+#include "latency.h"
 
-struct debug_vertex
+#define DEBUG_COLUMNS 24
+#define DEBUG_ROWS 17
+
+struct debug_stats
+{
+  uint16_t pc;
+  uint16_t I;
+  uint8_t sp;
+  uint8_t delay_timer;
+  uint8_t sound_timer;
+  uint8_t V[16];
+  double mips;
+  // Milliseconds between the last two swaps
+  double frame_time;
+  // Set with --latency, milliseconds per stage.
+  int show_latency;
+  double latency_p50[LATENCY_STAGE_COUNT];
+  double latency_p99[LATENCY_STAGE_COUNT];
+};
+
+#define RENDER_PBO_COUNT 3
+
+// Milliseconds spent in init_renderer
+struct render_startup
 {
-  float pos_x;
-  float pos_y;
-  float uv_x;
-  float uv_y;
+  double context;
+  // Programs, textures and buffers
+  double setup;
+  int cached_programs;
 };
 
 struct render_data
 {
   GLFWwindow* window;
-  uint8_t texture_data[CHIP8_SCREEN_WIDTH * CHIP8_SCREEN_HEIGHT * 3];
+  struct render_startup startup;
+  // Kept up to date by the key callback, which also feeds input.
+  uint16_t pressed;
+  struct input_queue* input;
+  uint8_t texture_data[CHIP8_PACKED_DISPLAY_SIZE];
+  // What the display texture holds, rows are uploaded only when they differ.
+  uint8_t uploaded[CHIP8_PACKED_DISPLAY_SIZE];
+  int force_present;
+  unsigned int skipped_presents;
   unsigned int shader;
   unsigned int vbo;
   unsigned int vao;
   unsigned int texture;
 
-  struct debug_vertex debug_vertices[4 * 5 * 21];
-  unsigned int debug_indices[(4 + 5 + 21) / 4 * 6];
+  // Display uploads go through a ring of pixel buffers, each fenced until
+  // the texture copy that reads it has finished.
+  int use_pbo;
+  int persistent_pbo;
+  unsigned int pbo[RENDER_PBO_COUNT];
+  uint8_t* pbo_mapped[RENDER_PBO_COUNT];
+  GLsync pbo_fence[RENDER_PBO_COUNT];
+  unsigned int pbo_index;
+  unsigned int skipped_uploads;
+
+  // The overlay text as last uploaded, one instance per character.
+  int show_debug;
+  int debug_changed;
+  char debug_text[DEBUG_ROWS][DEBUG_COLUMNS];
+  unsigned int debug_shader;
   unsigned int debug_vbo;
   unsigned int debug_vao;
-  unsigned int debug_ebo;
   unsigned int debug_texture;
 };
 
 void init_renderer();
 int should_close();
-void poll_window(struct chip8_state* state);
-void render_display(struct chip8_state* state);
-void render_debug(struct chip8_state* state);
+uint16_t poll_window();
+uint16_t wait_window(double timeout);
+// Key events go to queue from now on, NULL stops them.
+void set_input_queue(struct input_queue* queue);
+// Both return 0 without drawing when neither the display nor the overlay
+// changed since the last frame shown.
+int render_display(struct chip8_state* state);
+// Draws a display packed by chip8_pack_display and swaps.
+int render_frame(const uint8_t* packed);
+void render_use_pbo(int enable);
+// For drawing of your own, render_frame and render_display swap by themselves.
+void render_present();
+// Links a program, from the binary cache when the driver allows it.
+unsigned int create_program(const char* vertex_source, const char* fragment_source);
+const struct render_startup* render_startup_times();
+// Shown after the window title, NULL clears it.
+void render_set_status(const char* status);
+// Updates the overlay drawn by the following frames, NULL hides it.
+void render_debug(struct debug_stats* stats);
 
 #endif
\ No newline at end of file
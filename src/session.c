@@ -0,0 +1,252 @@
+#include "session.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Registers, timers and stack as they are, memory XORed with the reference,
+// display as bits.
+#define SESSION_HEADER_SIZE offsetof(struct chip8_state, display)
+#define SESSION_MEMORY_SIZE sizeof(((struct chip8_state*)0)->memory)
+#define SESSION_RAW_SIZE (SESSION_HEADER_SIZE + SESSION_MEMORY_SIZE + CHIP8_PACKED_DISPLAY_SIZE)
+// Literals cost one control byte per 128.
+#define SESSION_ENCODED_SIZE (SESSION_RAW_SIZE + SESSION_RAW_SIZE / 128 + 1)
+
+// A control byte c below 128 is followed by c + 1 literal bytes, from 128
+// up it is followed by one byte that repeats c - 125 times, 3 to 130.
+static uint32_t rle_encode(const uint8_t* in, uint32_t size, uint8_t* out)
+{
+  uint32_t length = 0;
+  uint32_t i = 0;
+  while (i < size)
+  {
+    uint32_t run = 1;
+    while (i + run < size && run < 130 && in[i + run] == in[i])
+    {
+      run += 1;
+    }
+    if (run >= 3)
+    {
+      out[length++] = run + 125;
+      out[length++] = in[i];
+      i += run;
+      continue;
+    }
+
+    // Literals up to the next run worth encoding.
+    uint32_t start = i;
+    while (i < size && i - start < 128 && !(i + 2 < size && in[i] == in[i + 1] && in[i] == in[i + 2]))
+    {
+      i += 1;
+    }
+    out[length++] = i - start - 1;
+    memcpy(&out[length], &in[start], i - start);
+    length += i - start;
+  }
+  return length;
+}
+
+static void rle_decode(const uint8_t* in, uint32_t size, uint8_t* out)
+{
+  uint32_t i = 0;
+  while (i < size)
+  {
+    uint8_t control = in[i++];
+    if (control < 128)
+    {
+      memcpy(out, &in[i], control + 1);
+      out += control + 1;
+      i += control + 1;
+    }
+    else
+    {
+      memset(out, in[i++], control - 125);
+      out += control - 125;
+    }
+  }
+}
+
+struct session_manager* new_session_manager(struct chip8_state* reference)
+{
+  struct session_manager* manager = aligned_alloc(64, sizeof(struct session_manager));
+  memset(manager, 0, sizeof(struct session_manager));
+  memcpy(&manager->reference, reference, sizeof(struct chip8_state));
+  chip8_own_memory(&manager->reference);
+  manager->scratch = malloc(SESSION_RAW_SIZE + SESSION_ENCODED_SIZE);
+  return manager;
+}
+
+void delete_session_manager(struct session_manager* manager)
+{
+  for (uint32_t i = 0; i < manager->count; ++i)
+  {
+    free(manager->sessions[i].state);
+    free(manager->sessions[i].parked);
+  }
+  free(manager->sessions);
+  free(manager->closed);
+  free(manager->scratch);
+  free(manager);
+}
+
+uint32_t session_open(struct session_manager* manager, uint32_t seed)
+{
+  uint32_t id;
+  if (manager->closed_count > 0)
+  {
+    id = manager->closed[--manager->closed_count];
+  }
+  else
+  {
+    if (manager->count == manager->capacity)
+    {
+      manager->capacity = manager->capacity == 0 ? 64 : manager->capacity * 2;
+      manager->sessions = realloc(manager->sessions, manager->capacity * sizeof(struct session));
+      manager->closed = realloc(manager->closed, manager->capacity * sizeof(uint32_t));
+    }
+    id = manager->count++;
+  }
+
+  struct session* session = &manager->sessions[id];
+  session->state = aligned_alloc(64, sizeof(struct chip8_state));
+  memcpy(session->state, &manager->reference, sizeof(struct chip8_state));
+  chip8_seed(session->state, seed);
+  session->parked = NULL;
+  session->parked_size = 0;
+
+  manager->footprint.live += 1;
+  manager->footprint.live_bytes += sizeof(struct chip8_state);
+  return id;
+}
+
+void session_close(struct session_manager* manager, uint32_t id)
+{
+  struct session* session = &manager->sessions[id];
+  // Already closed, its id is on the closed list once.
+  if (session->state == NULL && session->parked == NULL)
+  {
+    return;
+  }
+  if (session->state != NULL)
+  {
+    manager->footprint.live -= 1;
+    manager->footprint.live_bytes -= sizeof(struct chip8_state);
+  }
+  if (session->parked != NULL)
+  {
+    manager->footprint.parked -= 1;
+    manager->footprint.parked_bytes -= session->parked_size;
+  }
+  free(session->state);
+  free(session->parked);
+  session->state = NULL;
+  session->parked = NULL;
+  manager->closed[manager->closed_count++] = id;
+}
+
+static void unpark(struct session_manager* manager, struct session* session)
+{
+  uint8_t* raw = manager->scratch;
+  rle_decode(session->parked, session->parked_size, raw);
+
+  struct chip8_state* state = aligned_alloc(64, sizeof(struct chip8_state));
+  memcpy(state, raw, SESSION_HEADER_SIZE);
+  const uint8_t* memory = raw + SESSION_HEADER_SIZE;
+  for (uint32_t i = 0; i < SESSION_MEMORY_SIZE; ++i)
+  {
+    state->memory[i] = memory[i] ^ manager->reference.memory[i];
+  }
+  const uint8_t* packed = memory + SESSION_MEMORY_SIZE;
+  for (int i = 0; i < CHIP8_SCREEN_WIDTH * CHIP8_SCREEN_HEIGHT; ++i)
+  {
+    state->display[i] = packed[i / 8] >> (i % 8) & 1;
+  }
+
+  manager->footprint.parked -= 1;
+  manager->footprint.parked_bytes -= session->parked_size;
+  manager->footprint.live += 1;
+  manager->footprint.live_bytes += sizeof(struct chip8_state);
+  manager->footprint.unparks += 1;
+  free(session->parked);
+  session->parked = NULL;
+  session->parked_size = 0;
+  session->state = state;
+}
+
+struct chip8_state* session_state(struct session_manager* manager, uint32_t id)
+{
+  struct session* session = &manager->sessions[id];
+  if (session->state == NULL && session->parked != NULL)
+  {
+    unpark(manager, session);
+  }
+  return session->state;
+}
+
+int session_run(struct session_manager* manager, uint32_t id, uint16_t keys, uint32_t frames)
+{
+  struct chip8_state* state = session_state(manager, id);
+  if (state == NULL)
+  {
+    return CHIP8_EXIT_DONE;
+  }
+  return chip8_run_frames_through(state, keys, frames, CHIP8_CYCLES_PER_FRAME);
+}
+
+int session_idle(struct chip8_state* state)
+{
+  uint16_t opcode = chip8_read(state, state->pc & 0x0FFF) << 8 | chip8_read(state, (state->pc + 1) & 0x0FFF);
+  // Fx0A copies input into waiting_input every cycle and only moves on
+  // for a key that is down in input but not in waiting_input.
+  return (opcode & 0xF0FF) == 0xF00A && state->delay_timer == 0 && state->sound_timer == 0
+    && memcmp(state->input, state->waiting_input, sizeof(state->input)) == 0;
+}
+
+int session_park(struct session_manager* manager, uint32_t id)
+{
+  struct session* session = &manager->sessions[id];
+  struct chip8_state* state = session->state;
+  if (state == NULL || !session_idle(state))
+  {
+    return 0;
+  }
+
+  // Shared pages read back as the reference, like every other page that
+  // was not written, so they XOR to zero.
+  uint8_t* raw = manager->scratch;
+  memcpy(raw, state, SESSION_HEADER_SIZE);
+  uint8_t* memory = raw + SESSION_HEADER_SIZE;
+  for (uint32_t page = 0; page < SESSION_MEMORY_SIZE / CHIP8_PAGE_SIZE; ++page)
+  {
+    const uint8_t* source = state->shared_pages >> page & 1 ? state->shared_memory : state->memory;
+    for (uint32_t i = page * CHIP8_PAGE_SIZE; i < (page + 1) * CHIP8_PAGE_SIZE; ++i)
+    {
+      memory[i] = source[i] ^ manager->reference.memory[i];
+    }
+  }
+  chip8_pack_display(state, memory + SESSION_MEMORY_SIZE);
+
+  uint8_t* encoded = raw + SESSION_RAW_SIZE;
+  uint32_t size = rle_encode(raw, SESSION_RAW_SIZE, encoded);
+  session->parked = malloc(size);
+  memcpy(session->parked, encoded, size);
+  session->parked_size = size;
+  free(state);
+  session->state = NULL;
+
+  manager->footprint.live -= 1;
+  manager->footprint.live_bytes -= sizeof(struct chip8_state);
+  manager->footprint.parked += 1;
+  manager->footprint.parked_bytes += size;
+  manager->footprint.parks += 1;
+  return 1;
+}
+
+uint32_t session_park_idle(struct session_manager* manager)
+{
+  uint32_t parked = 0;
+  for (uint32_t id = 0; id < manager->count; ++id)
+  {
+    parked += session_park(manager, id);
+  }
+  return parked;
+}
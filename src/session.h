@@ -0,0 +1,74 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+#include <stdint.h>
+#include "chip8.h"
+
+// Many long lived instances of one ROM, most of them blocked on Fx0A. A
+// session that is waiting for a key with its timers stopped cannot change
+// until a key goes down, so it can be parked: compressed into a small blob
+// and its state freed. Running it again unparks it first, which is exact
+// because the frames it missed would have changed nothing.
+//
+// A parked blob is the state with its memory XORed against the reference
+// and its display packed to bits, run length encoded. Pages the state still
+// shares are not stored.
+
+struct session
+{
+  // NULL while parked
+  struct chip8_state* state;
+  uint8_t* parked;
+  uint32_t parked_size;
+};
+
+struct session_footprint
+{
+  uint32_t live;
+  uint32_t parked;
+  // Bytes held by live states and by parked blobs, without allocator
+  // overhead.
+  uint64_t live_bytes;
+  uint64_t parked_bytes;
+  uint64_t parks;
+  uint64_t unparks;
+};
+
+struct session_manager
+{
+  // What new sessions start from and what parked memory is compared with.
+  struct chip8_state reference;
+  struct session* sessions;
+  uint32_t count;
+  uint32_t capacity;
+  uint32_t* closed;
+  uint32_t closed_count;
+  struct session_footprint footprint;
+  // Room for one blob before it is trimmed to size.
+  uint8_t* scratch;
+};
+
+// reference is copied, usually a state with the ROM loaded.
+struct session_manager* new_session_manager(struct chip8_state* reference);
+void delete_session_manager(struct session_manager* manager);
+
+// Returns the id of a new session, a copy of the reference with its own seed.
+uint32_t session_open(struct session_manager* manager, uint32_t seed);
+// Closing a closed session does nothing.
+void session_close(struct session_manager* manager, uint32_t id);
+
+// The live state of a session, unparked if it was parked.
+struct chip8_state* session_state(struct session_manager* manager, uint32_t id);
+// chip8_run_frames_through on the session, unparking it first. Returns
+// CHIP8_EXIT_FAULT when an instruction faulted, the state's fault says which.
+int session_run(struct session_manager* manager, uint32_t id, uint16_t keys, uint32_t frames);
+
+// 1 when the state is blocked on Fx0A and running it with the keys it has
+// would change nothing.
+int session_idle(struct chip8_state* state);
+// Parks the session if it is idle, returns 1 when it was parked.
+int session_park(struct session_manager* manager, uint32_t id);
+// Parks every idle live session and returns how many were parked.
+uint32_t session_park_idle(struct session_manager* manager);
+
+#endif
@@ -0,0 +1,310 @@
+#include "software.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#define SOFTWARE_SSE2
+#endif
+#if defined(SOFTWARE_SSE2) && defined(__GNUC__)
+#define SOFTWARE_AVX2
+#endif
+
+// Pixels and masks start on a cache line and every row is a multiple of
+// 64 bytes long, so the vector kernels use aligned loads and stores.
+
+static int always()
+{
+  return 1;
+}
+
+static void expand_scalar(uint32_t* out, const uint32_t* masks, uint32_t width, uint64_t row, const uint32_t* palette)
+{
+  uint32_t half = width / 2;
+  for (uint32_t x = 0; x < width; ++x)
+  {
+    uint32_t word = x < half ? (uint32_t)row : (uint32_t)(row >> 32);
+    out[x] = palette[(word & masks[x]) != 0];
+  }
+}
+
+#ifdef SOFTWARE_SSE2
+static void expand_sse2(uint32_t* out, const uint32_t* masks, uint32_t width, uint64_t row, const uint32_t* palette)
+{
+  __m128i off = _mm_set1_epi32(palette[0]);
+  __m128i on = _mm_set1_epi32(palette[1]);
+  uint32_t half = width / 2;
+  for (uint32_t start = 0; start < width; start += half)
+  {
+    __m128i word = _mm_set1_epi32((uint32_t)(row >> (start == 0 ? 0 : 32)));
+    for (uint32_t x = start; x < start + half; x += 4)
+    {
+      __m128i mask = _mm_load_si128((const __m128i*)&masks[x]);
+      __m128i set = _mm_cmpeq_epi32(_mm_and_si128(word, mask), mask);
+      _mm_store_si128((__m128i*)&out[x], _mm_or_si128(_mm_and_si128(set, on), _mm_andnot_si128(set, off)));
+    }
+  }
+}
+#endif
+
+#ifdef SOFTWARE_AVX2
+static int has_avx2()
+{
+  return __builtin_cpu_supports("avx2");
+}
+
+__attribute__((target("avx2")))
+static void expand_avx2(uint32_t* out, const uint32_t* masks, uint32_t width, uint64_t row, const uint32_t* palette)
+{
+  __m256i off = _mm256_set1_epi32(palette[0]);
+  __m256i on = _mm256_set1_epi32(palette[1]);
+  uint32_t half = width / 2;
+  for (uint32_t start = 0; start < width; start += half)
+  {
+    __m256i word = _mm256_set1_epi32((uint32_t)(row >> (start == 0 ? 0 : 32)));
+    for (uint32_t x = start; x < start + half; x += 8)
+    {
+      __m256i mask = _mm256_load_si256((const __m256i*)&masks[x]);
+      __m256i set = _mm256_cmpeq_epi32(_mm256_and_si256(word, mask), mask);
+      _mm256_store_si256((__m256i*)&out[x], _mm256_blendv_epi8(off, on, set));
+    }
+  }
+}
+#endif
+
+// Images larger than this do not stay in the cache anyway, copies of a
+// line bypass it instead of evicting the source line and the masks.
+#define SOFTWARE_STREAM_SIZE (4 << 20)
+
+static void copy_line(uint32_t* out, const uint32_t* line, uint32_t width, int stream)
+{
+#ifdef SOFTWARE_SSE2
+  if (stream)
+  {
+    for (uint32_t x = 0; x < width; x += 4)
+    {
+      _mm_stream_si128((__m128i*)&out[x], _mm_load_si128((const __m128i*)&line[x]));
+    }
+    return;
+  }
+#endif
+  memcpy(out, line, width * sizeof(uint32_t));
+}
+
+// Fastest first
+const struct software_kernel software_kernels[] = {
+#ifdef SOFTWARE_AVX2
+  { "avx2", has_avx2, expand_avx2 },
+#endif
+#ifdef SOFTWARE_SSE2
+  { "sse2", always, expand_sse2 },
+#endif
+  { "scalar", always, expand_scalar },
+};
+
+const int software_kernel_count = sizeof(software_kernels) / sizeof(software_kernels[0]);
+
+const struct software_kernel* find_software_kernel(const char* name)
+{
+  for (int i = 0; i < software_kernel_count; ++i)
+  {
+    if (strcmp(software_kernels[i].name, name) == 0)
+    {
+      return software_kernels[i].supported() ? &software_kernels[i] : NULL;
+    }
+  }
+  return NULL;
+}
+
+static void share_image(struct software_renderer* renderer, const char* name)
+{
+#ifndef _WIN32
+  int file = shm_open(name, O_CREAT | O_RDWR, 0644);
+  if (file < 0)
+  {
+    perror("Error");
+    return;
+  }
+  if (ftruncate(file, renderer->image_size) != 0)
+  {
+    perror("Error");
+    close(file);
+    return;
+  }
+  void* image = mmap(NULL, renderer->image_size, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+  close(file);
+  if (image == MAP_FAILED)
+  {
+    perror("Error");
+    return;
+  }
+
+  renderer->image = image;
+  renderer->image_name = strdup(name);
+  memcpy(renderer->image->magic, SOFTWARE_IMAGE_MAGIC, 4);
+  renderer->image->width = renderer->width;
+  renderer->image->height = renderer->height;
+  atomic_store(&renderer->image->sequence, 0);
+  renderer->pixels = (uint32_t*)((uint8_t*)image + 64);
+#else
+  printf("(ERROR) Shared memory images are not supported on this platform\n");
+#endif
+}
+
+struct software_renderer* new_software_renderer(uint32_t scale, const char* shared_name)
+{
+  struct software_renderer* renderer = malloc(sizeof(struct software_renderer));
+  memset(renderer, 0, sizeof(struct software_renderer));
+  renderer->scale = scale;
+  renderer->width = CHIP8_SCREEN_WIDTH * scale;
+  renderer->height = CHIP8_SCREEN_HEIGHT * scale;
+
+  // Black and white, like the window.
+  const uint8_t colors[2][4] = { { 0, 0, 0, 255 }, { 255, 255, 255, 255 } };
+  memcpy(renderer->palette, colors, sizeof(colors));
+
+  for (int i = 0; i < software_kernel_count && renderer->kernel == NULL; ++i)
+  {
+    if (software_kernels[i].supported())
+    {
+      renderer->kernel = &software_kernels[i];
+    }
+  }
+
+  renderer->masks = aligned_alloc(64, renderer->width * sizeof(uint32_t));
+  for (uint32_t x = 0; x < renderer->width; ++x)
+  {
+    renderer->masks[x] = 1u << (x / scale % 32);
+  }
+
+  uint64_t pixels_size = (uint64_t)renderer->width * renderer->height * sizeof(uint32_t);
+  renderer->image_size = 64 + pixels_size;
+  if (shared_name != NULL)
+  {
+    share_image(renderer, shared_name);
+  }
+  if (renderer->pixels == NULL)
+  {
+    renderer->pixels = aligned_alloc(64, pixels_size);
+  }
+
+  // Everything drawn once so the pixels match the blank display in shown.
+  software_render_rows(renderer, renderer->shown, 0xFFFFFFFF);
+  return renderer;
+}
+
+void delete_software_renderer(struct software_renderer* renderer)
+{
+#ifndef _WIN32
+  if (renderer->image != NULL)
+  {
+    munmap(renderer->image, renderer->image_size);
+    shm_unlink(renderer->image_name);
+    free(renderer->image_name);
+  }
+#endif
+  if (renderer->image == NULL)
+  {
+    free(renderer->pixels);
+  }
+  free(renderer->masks);
+  free(renderer);
+}
+
+void software_render_rows(struct software_renderer* renderer, const uint8_t* packed, uint32_t rows)
+{
+  if (renderer->image != NULL)
+  {
+    atomic_fetch_add_explicit(&renderer->image->sequence, 1, memory_order_acq_rel);
+  }
+
+  // One expanded line per display row, the other scale - 1 are copies.
+  int stream = renderer->image_size > SOFTWARE_STREAM_SIZE;
+  for (; rows != 0; rows &= rows - 1)
+  {
+    int y = __builtin_ctz(rows);
+    uint64_t row;
+    memcpy(&row, &packed[y * 8], sizeof(row));
+    uint32_t* line = &renderer->pixels[(uint64_t)y * renderer->scale * renderer->width];
+    renderer->kernel->expand(line, renderer->masks, renderer->width, row, renderer->palette);
+    for (uint32_t i = 1; i < renderer->scale; ++i)
+    {
+      copy_line(&line[i * renderer->width], line, renderer->width, stream);
+    }
+    renderer->rows_drawn += 1;
+  }
+#ifdef SOFTWARE_SSE2
+  _mm_sfence();
+#endif
+
+  if (renderer->image != NULL)
+  {
+    atomic_fetch_add_explicit(&renderer->image->sequence, 1, memory_order_release);
+  }
+}
+
+uint32_t software_render_frame(struct software_renderer* renderer, const uint8_t* packed)
+{
+  uint32_t rows = 0;
+  for (int y = 0; y < CHIP8_SCREEN_HEIGHT; ++y)
+  {
+    if (memcmp(&packed[y * 8], &renderer->shown[y * 8], 8) != 0)
+    {
+      rows |= 1u << y;
+    }
+  }
+
+  if (rows != 0)
+  {
+    software_render_rows(renderer, packed, rows);
+    memcpy(renderer->shown, packed, CHIP8_PACKED_DISPLAY_SIZE);
+    renderer->frames += 1;
+  }
+  return rows;
+}
+
+int software_write_ppm(struct software_renderer* renderer, const char* path)
+{
+  char temporary[1024];
+  snprintf(temporary, sizeof(temporary), "%s.tmp", path);
+  FILE* file = fopen(temporary, "wb");
+  if (file == NULL)
+  {
+    perror("Error");
+    return 0;
+  }
+
+  // PPM has no alpha, rows are converted one at a time.
+  fprintf(file, "P6\n%u %u\n255\n", renderer->width, renderer->height);
+  uint8_t* rgb = malloc(renderer->width * 3);
+  for (uint32_t y = 0; y < renderer->height; ++y)
+  {
+    const uint8_t* rgba = (const uint8_t*)&renderer->pixels[(uint64_t)y * renderer->width];
+    for (uint32_t x = 0; x < renderer->width; ++x)
+    {
+      rgb[x * 3 + 0] = rgba[x * 4 + 0];
+      rgb[x * 3 + 1] = rgba[x * 4 + 1];
+      rgb[x * 3 + 2] = rgba[x * 4 + 2];
+    }
+    fwrite(rgb, 3, renderer->width, file);
+  }
+  free(rgb);
+
+  if (fclose(file) != 0)
+  {
+    perror("Error");
+    return 0;
+  }
+#ifdef _WIN32
+  remove(path);
+#endif
+  return rename(temporary, path) == 0;
+}
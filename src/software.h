@@ -0,0 +1,76 @@
+#ifndef SOFTWARE_H
+#define SOFTWARE_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include "chip8.h"
+
+// Presents packed displays without OpenGL: every pixel becomes a scale by
+// scale block of RGBA in a plain buffer, which can be written out as a PPM
+// or live in shared memory for another process to read.
+
+// Expands the pixels of one display row, bits 0-31 then 32-63, into width
+// RGBA pixels. masks holds 1 << (x % 32) for the source pixel x of every
+// output pixel, so any integer scale is the same loop.
+struct software_kernel
+{
+  const char* name;
+  int (*supported)();
+  void (*expand)(uint32_t* out, const uint32_t* masks, uint32_t width, uint64_t row, const uint32_t* palette);
+};
+
+extern const struct software_kernel software_kernels[];
+extern const int software_kernel_count;
+
+// NULL when there is no such kernel or the CPU lacks it.
+const struct software_kernel* find_software_kernel(const char* name);
+
+#define SOFTWARE_IMAGE_MAGIC "C8IM"
+
+// Start of the shared memory object, the pixels follow. sequence is odd
+// while a frame is being written, so a reader copies the pixels between two
+// equal even values.
+struct software_image
+{
+  char magic[4];
+  uint32_t width;
+  uint32_t height;
+  _Atomic uint32_t sequence;
+};
+
+struct software_renderer
+{
+  uint32_t scale;
+  uint32_t width;
+  uint32_t height;
+  // Off and on, RGBA in memory order
+  uint32_t palette[2];
+  const struct software_kernel* kernel;
+
+  // width * height pixels, right after image when shared.
+  uint32_t* pixels;
+  uint32_t* masks;
+  struct software_image* image;
+  uint64_t image_size;
+  char* image_name;
+
+  // The display the pixels show.
+  uint8_t shown[CHIP8_PACKED_DISPLAY_SIZE];
+  uint64_t frames;
+  uint64_t rows_drawn;
+};
+
+// shared_name is a POSIX shared memory name such as "/chip8", NULL keeps
+// the pixels private. Uses the fastest kernel the CPU has.
+struct software_renderer* new_software_renderer(uint32_t scale, const char* shared_name);
+void delete_software_renderer(struct software_renderer* renderer);
+
+// Redraws the rows that differ from the display shown and returns them,
+// 0 means the image did not change.
+uint32_t software_render_frame(struct software_renderer* renderer, const uint8_t* packed);
+// Redraws the given rows whether they changed or not.
+void software_render_rows(struct software_renderer* renderer, const uint8_t* packed, uint32_t rows);
+// Replaces path through a temporary file, so a reader never sees half a frame.
+int software_write_ppm(struct software_renderer* renderer, const char* path);
+
+#endif
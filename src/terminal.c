@@ -0,0 +1,194 @@
+#include "terminal.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+#define TERMINAL_LINES (CHIP8_SCREEN_HEIGHT / 2)
+// Worst case a move and a block for every cell, plus the screen setup
+#define TERMINAL_BUFFER_SIZE (TERMINAL_LINES * CHIP8_SCREEN_WIDTH * 16 + 64)
+
+// Indexed by top pixel | bottom pixel << 1
+static const char* glyphs[4] = { " ", "\xE2\x96\x80", "\xE2\x96\x84", "\xE2\x96\x88" };
+static const int glyph_lengths[4] = { 1, 3, 3, 3 };
+
+static const char keys[] = "1234qwerasdfzxcv";
+
+static void write_all(const char* buffer, uint32_t length)
+{
+#ifndef _WIN32
+  while (length > 0)
+  {
+    ssize_t written = write(STDOUT_FILENO, buffer, length);
+    if (written <= 0)
+    {
+      return;
+    }
+    buffer += written;
+    length -= written;
+  }
+#endif
+}
+
+struct terminal* new_terminal()
+{
+#ifndef _WIN32
+  if (!isatty(STDIN_FILENO) || !isatty(STDOUT_FILENO))
+  {
+    printf("(ERROR) --terminal needs stdin and stdout to be a terminal\n");
+    return NULL;
+  }
+
+  struct terminal* terminal = malloc(sizeof(struct terminal));
+  memset(terminal, 0, sizeof(struct terminal));
+  terminal->buffer = malloc(TERMINAL_BUFFER_SIZE);
+
+  // No echo, no line buffering and reads that never block. Signals stay on
+  // so Ctrl+C still interrupts.
+  tcgetattr(STDIN_FILENO, &terminal->saved);
+  struct termios raw = terminal->saved;
+  raw.c_lflag &= ~(ICANON | ECHO);
+  raw.c_iflag &= ~(IXON | ICRNL);
+  raw.c_cc[VMIN] = 0;
+  raw.c_cc[VTIME] = 0;
+  tcsetattr(STDIN_FILENO, TCSANOW, &raw);
+
+  // Alternate screen, hidden cursor, cleared. The shown display is blank
+  // and so is the screen.
+  const char* setup = "\x1b[?1049h\x1b[?25l\x1b[2J\x1b[H";
+  write_all(setup, strlen(setup));
+  terminal->cursor_line = 0;
+  terminal->cursor_column = 0;
+  return terminal;
+#else
+  printf("(ERROR) --terminal is not supported on this platform\n");
+  return NULL;
+#endif
+}
+
+void delete_terminal(struct terminal* terminal)
+{
+#ifndef _WIN32
+  const char* restore = "\x1b[?25h\x1b[?1049l";
+  write_all(restore, strlen(restore));
+  tcsetattr(STDIN_FILENO, TCSANOW, &terminal->saved);
+#endif
+  free(terminal->buffer);
+  free(terminal);
+}
+
+static uint64_t load_row(const uint8_t* packed, int y)
+{
+  uint64_t row;
+  memcpy(&row, &packed[y * 8], sizeof(row));
+  return row;
+}
+
+uint32_t terminal_render_frame(struct terminal* terminal, const uint8_t* packed)
+{
+  char* out = terminal->buffer;
+  for (int line = 0; line < TERMINAL_LINES; ++line)
+  {
+    uint64_t top = load_row(packed, line * 2);
+    uint64_t bottom = load_row(packed, line * 2 + 1);
+    uint64_t changed = (top ^ load_row(terminal->shown, line * 2)) | (bottom ^ load_row(terminal->shown, line * 2 + 1));
+
+    while (changed != 0)
+    {
+      int x = __builtin_ctzll(changed);
+
+      // A cursor move is 6 to 8 bytes, rewriting up to two unchanged cells
+      // on the way is never longer.
+      if (terminal->cursor_line == line && x >= terminal->cursor_column && x - terminal->cursor_column <= 2)
+      {
+        x = terminal->cursor_column;
+      }
+      else
+      {
+        out += sprintf(out, "\x1b[%d;%dH", line + 1, x + 1);
+      }
+
+      int cell = (top >> x & 1) | (bottom >> x & 1) << 1;
+      memcpy(out, glyphs[cell], glyph_lengths[cell]);
+      out += glyph_lengths[cell];
+      terminal->cursor_line = line;
+      terminal->cursor_column = x + 1;
+      changed &= x == 63 ? 0 : ~0ull << (x + 1);
+    }
+  }
+
+  uint32_t length = out - terminal->buffer;
+  if (length == 0)
+  {
+    return 0;
+  }
+  // Past the last column the cursor position depends on the terminal.
+  if (terminal->cursor_column == CHIP8_SCREEN_WIDTH)
+  {
+    terminal->cursor_line = -1;
+  }
+
+  write_all(terminal->buffer, length);
+  memcpy(terminal->shown, packed, CHIP8_PACKED_DISPLAY_SIZE);
+  terminal->frames += 1;
+  terminal->bytes += length;
+  return length;
+}
+
+static void set_key(struct terminal* terminal, uint64_t now, int key, int pressed)
+{
+  int held = (terminal->pressed >> key & 1) != 0;
+  terminal->pressed = pressed ? terminal->pressed | 1 << key : terminal->pressed & ~(1 << key);
+  if (held != pressed && terminal->input != NULL)
+  {
+    input_queue_push(terminal->input, now, key, pressed);
+  }
+}
+
+uint16_t terminal_poll(struct terminal* terminal, uint64_t now)
+{
+#ifndef _WIN32
+  char input[64];
+  ssize_t length;
+  while ((length = read(STDIN_FILENO, input, sizeof(input))) > 0)
+  {
+    for (ssize_t i = 0; i < length; ++i)
+    {
+      // A lone Escape quits, arrow and function keys arrive as Escape
+      // sequences and are skipped up to their final byte.
+      if (input[i] == 0x1b)
+      {
+        if (i + 1 == length)
+        {
+          terminal->quit = 1;
+        }
+        for (i += 1; i + 1 < length && (input[i] == '[' || input[i] == 'O' || (input[i] >= '0' && input[i] <= '9') || input[i] == ';'); ++i)
+        {
+        }
+        continue;
+      }
+
+      const char* key = input[i] != '\0' ? strchr(keys, tolower((unsigned char)input[i])) : NULL;
+      if (key != NULL)
+      {
+        set_key(terminal, now, key - keys, 1);
+        terminal->release[key - keys] = now + TERMINAL_HOLD_NS;
+      }
+    }
+  }
+#endif
+
+  for (int i = 0; i < 16; ++i)
+  {
+    if ((terminal->pressed >> i & 1) != 0 && now >= terminal->release[i])
+    {
+      set_key(terminal, now, i, 0);
+    }
+  }
+  return terminal->pressed;
+}
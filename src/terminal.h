@@ -0,0 +1,55 @@
+#ifndef TERMINAL_H
+#define TERMINAL_H
+
+#include <stdint.h>
+#include "chip8.h"
+#include "input_queue.h"
+
+#ifndef _WIN32
+#include <termios.h>
+#endif
+
+// Draws the display on a text terminal, two pixel rows per line with half
+// block characters. Only cells that changed since the last frame are sent,
+// each frame is a single write.
+
+// Terminals only report presses, a key counts as held this long after the
+// last one, which key repeat keeps extending.
+#define TERMINAL_HOLD_NS 150000000ull
+
+struct terminal
+{
+#ifndef _WIN32
+  struct termios saved;
+#endif
+  int quit;
+
+  // The display on screen and where the cursor was left.
+  uint8_t shown[CHIP8_PACKED_DISPLAY_SIZE];
+  int cursor_line;
+  int cursor_column;
+  char* buffer;
+
+  // Held keys, released once now passes their time.
+  uint16_t pressed;
+  uint64_t release[16];
+  struct input_queue* input;
+
+  uint64_t frames;
+  uint64_t bytes;
+};
+
+// Switches stdin to raw mode and draws on the alternate screen of stdout.
+// Returns NULL when stdin or stdout is not a terminal.
+struct terminal* new_terminal();
+// Restores the screen and the terminal settings.
+void delete_terminal(struct terminal* terminal);
+
+// Sends the cells that differ from the display shown, returns the bytes
+// written, 0 when nothing changed.
+uint32_t terminal_render_frame(struct terminal* terminal, const uint8_t* packed);
+// Reads pending keys: 1234 QWER ASDF ZXCV like the window, Escape quits.
+// Presses and releases also go to input when it is set.
+uint16_t terminal_poll(struct terminal* terminal, uint64_t now);
+
+#endif
@@ -0,0 +1,399 @@
+#include "trace.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+
+static uint8_t* put_varint(uint8_t* out, uint32_t value)
+{
+  while (value >= 0x80)
+  {
+    *out++ = (value & 0x7F) | 0x80;
+    value >>= 7;
+  }
+  *out++ = value;
+  return out;
+}
+
+static uint8_t* get_varint(uint8_t* in, uint32_t* value)
+{
+  uint32_t result = 0;
+  int shift = 0;
+  while (*in & 0x80)
+  {
+    result |= (uint32_t)(*in++ & 0x7F) << shift;
+    shift += 7;
+  }
+  result |= (uint32_t)*in++ << shift;
+  *value = result;
+  return in;
+}
+
+static uint16_t input_mask(uint8_t* input)
+{
+  uint16_t mask = 0;
+  for (int i = 0; i < 16; ++i)
+  {
+    mask |= (input[i] & 1) << i;
+  }
+  return mask;
+}
+
+static int write_chunk(FILE* file, struct trace_chunk* chunk)
+{
+  if (fwrite(&chunk->first, sizeof(chunk->first), 1, file) != 1
+    || fwrite(&chunk->count, sizeof(chunk->count), 1, file) != 1
+    || fwrite(&chunk->size, sizeof(chunk->size), 1, file) != 1
+    || fwrite(&chunk->start, sizeof(chunk->start), 1, file) != 1
+    || fwrite(chunk->data, 1, chunk->size, file) != chunk->size)
+  {
+    return -1;
+  }
+  return 0;
+}
+
+// Reported once, later chunks are dropped so the emulator never waits on a
+// writer that cannot make progress.
+static void write_failed(struct trace* trace)
+{
+  if (atomic_exchange(&trace->failed, 1) == 0)
+  {
+    perror("Error");
+    printf("(ERROR) Could not write the trace, the rest of it is dropped\n");
+  }
+}
+
+static int writer_main(void* arg)
+{
+  struct trace* trace = arg;
+  uint64_t tail = 0;
+
+  while (1)
+  {
+    // Read stop first so the final head is visible once it is set.
+    int stopping = atomic_load(&trace->stop);
+    uint64_t head = atomic_load_explicit(&trace->head, memory_order_acquire);
+    if (tail == head)
+    {
+      if (stopping)
+      {
+        break;
+      }
+      thrd_sleep(&(struct timespec){ .tv_nsec = 1000000 }, NULL);
+      continue;
+    }
+
+    if (!atomic_load(&trace->failed) && write_chunk(trace->file, trace->slots[tail % trace->slot_count]) != 0)
+    {
+      write_failed(trace);
+    }
+    tail += 1;
+    atomic_store_explicit(&trace->tail, tail, memory_order_release);
+  }
+
+  return 0;
+}
+
+struct trace* new_trace(const char* path, uint64_t ring_instructions)
+{
+  FILE* file = fopen(path, "wb");
+  if (file == NULL)
+  {
+    perror("Error");
+    return NULL;
+  }
+
+  uint32_t version = TRACE_VERSION;
+  uint32_t state_size = sizeof(struct chip8_state);
+  if (fwrite(TRACE_MAGIC, 1, 4, file) != 4
+    || fwrite(&version, sizeof(version), 1, file) != 1
+    || fwrite(&state_size, sizeof(state_size), 1, file) != 1)
+  {
+    perror("Error");
+    fclose(file);
+    return NULL;
+  }
+
+  struct trace* trace = calloc(1, sizeof(struct trace));
+  trace->file = file;
+  trace->ring_chunks = ring_instructions == 0 ? 0 : ring_instructions / TRACE_CHUNK_RECORDS + 2;
+  trace->slot_count = ring_instructions == 0 ? 8 : trace->ring_chunks;
+  trace->slots = malloc(trace->slot_count * sizeof(struct trace_chunk*));
+  for (uint32_t i = 0; i < trace->slot_count; ++i)
+  {
+    trace->slots[i] = aligned_alloc(64, sizeof(struct trace_chunk));
+    trace->slots[i]->count = 0;
+  }
+  trace->chunk = trace->slots[0];
+  trace->chunk->first = 0;
+
+  if (trace->ring_chunks == 0)
+  {
+    thrd_create(&trace->writer, writer_main, trace);
+  }
+
+  return trace;
+}
+
+static void publish_chunk(struct trace* trace)
+{
+  uint64_t head = atomic_load_explicit(&trace->head, memory_order_relaxed) + 1;
+  atomic_store_explicit(&trace->head, head, memory_order_release);
+
+  // Streaming never overwrites a chunk the writer has not flushed yet,
+  // ring mode simply reuses the oldest one.
+  if (trace->ring_chunks == 0)
+  {
+    while (head - atomic_load_explicit(&trace->tail, memory_order_acquire) >= trace->slot_count)
+    {
+      thrd_yield();
+    }
+  }
+
+  trace->chunk = trace->slots[head % trace->slot_count];
+  trace->chunk->count = 0;
+}
+
+int delete_trace(struct trace* trace)
+{
+  if (trace->chunk->count > 0)
+  {
+    atomic_store_explicit(&trace->head, atomic_load(&trace->head) + 1, memory_order_release);
+  }
+
+  if (trace->ring_chunks == 0)
+  {
+    atomic_store(&trace->stop, 1);
+    thrd_join(trace->writer, NULL);
+  }
+  else
+  {
+    uint64_t head = atomic_load(&trace->head);
+    uint64_t first = head > trace->slot_count ? head - trace->slot_count : 0;
+    for (uint64_t i = first; i < head; ++i)
+    {
+      // The slot after the newest chunk may already have been handed out again.
+      struct trace_chunk* chunk = trace->slots[i % trace->slot_count];
+      if (chunk->count > 0 && !atomic_load(&trace->failed) && write_chunk(trace->file, chunk) != 0)
+      {
+        write_failed(trace);
+      }
+    }
+  }
+
+  // Buffered data is only written here, so its errors show up here.
+  if (fclose(trace->file) != 0)
+  {
+    write_failed(trace);
+  }
+  int failed = atomic_load(&trace->failed);
+  for (uint32_t i = 0; i < trace->slot_count; ++i)
+  {
+    free(trace->slots[i]);
+  }
+  free(trace->slots);
+  free(trace);
+  return failed ? -1 : 0;
+}
+
+void trace_start_chunk(struct trace* trace, struct chip8_state* state)
+{
+  struct trace_chunk* chunk = trace->chunk;
+  uint64_t first = chunk->first + chunk->count;
+  if (chunk->count == TRACE_CHUNK_RECORDS)
+  {
+    publish_chunk(trace);
+    chunk = trace->chunk;
+  }
+
+  chunk->first = first;
+  chunk->size = 0;
+  // Written to disk, so shared pages are copied in and the pointer to
+  // them dropped.
+  chunk->start = *state;
+  chip8_own_memory(&chunk->start);
+
+  // The snapshot already holds the keys and timers as they are now.
+  memcpy(trace->input, state->input, sizeof(trace->input));
+  trace->event_record = 0;
+  trace->ticked = 0;
+}
+
+// Keys or timers changed from outside since the last record.
+void trace_record_event(struct trace* trace, struct chip8_state* state)
+{
+  struct trace_chunk* chunk = trace->chunk;
+  uint8_t* out = chunk->data + chunk->size;
+  out = put_varint(out, chunk->count - trace->event_record);
+  uint8_t* flags_out = out++;
+  uint8_t flags = 0;
+
+  if (trace->ticked)
+  {
+    flags |= TRACE_EVENT_TIMERS;
+    *out++ = state->delay_timer;
+    *out++ = state->sound_timer;
+    trace->ticked = 0;
+  }
+
+  if (memcmp(trace->input, state->input, sizeof(trace->input)) != 0)
+  {
+    flags |= TRACE_EVENT_INPUT;
+    uint16_t mask = input_mask(state->input);
+    *out++ = mask & 0xFF;
+    *out++ = mask >> 8;
+    memcpy(trace->input, state->input, sizeof(trace->input));
+  }
+
+  *flags_out = flags;
+  chunk->size = out - chunk->data;
+  trace->event_record = chunk->count;
+}
+
+void trace_tick(struct trace* trace)
+{
+  trace->ticked = 1;
+}
+
+int trace_read_header(FILE* file)
+{
+  char magic[4];
+  uint32_t version;
+  uint32_t state_size;
+  if (fread(magic, 1, 4, file) != 4
+    || fread(&version, sizeof(version), 1, file) != 1
+    || fread(&state_size, sizeof(state_size), 1, file) != 1)
+  {
+    return -1;
+  }
+
+  if (memcmp(magic, TRACE_MAGIC, 4) != 0 || version != TRACE_VERSION || state_size != sizeof(struct chip8_state))
+  {
+    return -1;
+  }
+
+  return 0;
+}
+
+int trace_read_chunk(FILE* file, struct trace_chunk* chunk)
+{
+  if (fread(&chunk->first, sizeof(chunk->first), 1, file) != 1
+    || fread(&chunk->count, sizeof(chunk->count), 1, file) != 1
+    || fread(&chunk->size, sizeof(chunk->size), 1, file) != 1
+    || chunk->count > TRACE_CHUNK_RECORDS
+    || chunk->size > sizeof(chunk->data)
+    || fread(&chunk->start, sizeof(chunk->start), 1, file) != 1
+    || fread(chunk->data, 1, chunk->size, file) != chunk->size
+    || chunk->start.shared_pages != 0)
+  {
+    return 0;
+  }
+  chunk->start.shared_memory = NULL;
+
+  return 1;
+}
+
+static void read_event_index(struct trace_cursor* cursor, struct trace_chunk* chunk)
+{
+  if (cursor->offset >= chunk->size)
+  {
+    cursor->event = UINT64_MAX;
+    return;
+  }
+  uint32_t delta;
+  uint8_t* in = get_varint(chunk->data + cursor->offset, &delta);
+  cursor->offset = in - chunk->data;
+  cursor->event += delta;
+}
+
+void trace_cursor_init(struct trace_cursor* cursor, struct trace_chunk* chunk)
+{
+  struct trace_record* record = &cursor->record;
+
+  chip8_restore(&cursor->state, &chunk->start);
+  cursor->offset = 0;
+  cursor->remaining = chunk->count;
+  cursor->event = chunk->first;
+  read_event_index(cursor, chunk);
+
+  record->index = chunk->first - 1;
+  record->pc = chunk->start.pc - 2;
+  memcpy(record->V, chunk->start.V, sizeof(record->V));
+  record->I = chunk->start.I;
+  record->sp = chunk->start.sp;
+  record->delay_timer = chunk->start.delay_timer;
+  record->sound_timer = chunk->start.sound_timer;
+  record->input = input_mask(chunk->start.input);
+}
+
+int trace_cursor_next(struct trace_cursor* cursor, struct trace_chunk* chunk)
+{
+  if (cursor->remaining == 0)
+  {
+    return 0;
+  }
+
+  struct chip8_state* state = &cursor->state;
+  struct trace_record* record = &cursor->record;
+
+  if (cursor->remaining != chunk->count)
+  {
+    chip8_cycle(state);
+  }
+  record->index += 1;
+
+  while (cursor->event == record->index)
+  {
+    uint8_t* in = chunk->data + cursor->offset;
+    uint8_t flags = *in++;
+    if (flags & TRACE_EVENT_TIMERS)
+    {
+      state->delay_timer = in[0];
+      state->sound_timer = in[1];
+      in += 2;
+    }
+    if (flags & TRACE_EVENT_INPUT)
+    {
+      chip8_set_keys(state, in[0] | in[1] << 8);
+      in += 2;
+    }
+    cursor->offset = in - chunk->data;
+    read_event_index(cursor, chunk);
+  }
+
+  uint8_t flags = 0;
+  if (state->pc != (uint16_t)(record->pc + 2))
+  {
+    flags |= TRACE_PC;
+  }
+  record->pc = state->pc;
+  record->opcode = chip8_read(state, state->pc & 0x0FFF) << 8 | chip8_read(state, (state->pc + 1) & 0x0FFF);
+
+  record->v_mask = 0;
+  for (int i = 0; i < 16; ++i)
+  {
+    record->v_mask |= (record->V[i] != state->V[i]) << i;
+  }
+  if (record->v_mask != 0)
+  {
+    flags |= TRACE_V;
+    memcpy(record->V, state->V, sizeof(record->V));
+  }
+
+  uint16_t input = input_mask(state->input);
+  flags |= (record->I != state->I) * TRACE_I;
+  flags |= (record->sp != state->sp) * TRACE_SP;
+  flags |= (record->delay_timer != state->delay_timer) * TRACE_DELAY_TIMER;
+  flags |= (record->sound_timer != state->sound_timer) * TRACE_SOUND_TIMER;
+  flags |= (record->input != input) * TRACE_INPUT;
+  record->flags = flags;
+  record->I = state->I;
+  record->sp = state->sp;
+  record->delay_timer = state->delay_timer;
+  record->sound_timer = state->sound_timer;
+  record->input = input;
+
+  cursor->remaining -= 1;
+  return 1;
+}
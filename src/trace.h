@@ -0,0 +1,128 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <threads.h>
+#include "chip8.h"
+
+#define TRACE_MAGIC "C8TR"
+// Traces replay by executing again, so this changes with the format and
+// with any instruction that behaves differently.
+#define TRACE_VERSION 5
+#define TRACE_CHUNK_RECORDS 16384
+// An instruction index varint, flags, timers and keys.
+#define TRACE_MAX_EVENT_SIZE 10
+
+// Event flags, the matching fields follow the flags in this order.
+#define TRACE_EVENT_TIMERS 0x01
+#define TRACE_EVENT_INPUT 0x02
+
+// Record flags, set for the fields that differ from the previous record.
+#define TRACE_PC 0x01
+#define TRACE_V 0x02
+#define TRACE_I 0x04
+#define TRACE_SP 0x08
+#define TRACE_DELAY_TIMER 0x10
+#define TRACE_SOUND_TIMER 0x20
+#define TRACE_INPUT 0x40
+
+// The interpreter is deterministic, so a chunk holds only its snapshot and
+// what the instructions cannot reproduce: the keys and the timers wherever
+// they were set from outside. Records are rebuilt by running the snapshot
+// again, so each chunk decodes on its own.
+struct trace_chunk
+{
+  uint64_t first;
+  uint32_t count;
+  uint32_t size;
+  struct chip8_state start;
+  uint8_t data[TRACE_CHUNK_RECORDS * TRACE_MAX_EVENT_SIZE];
+};
+
+// Registers as they were before the instruction at pc ran.
+struct trace_record
+{
+  uint64_t index;
+  uint8_t flags;
+  uint16_t v_mask;
+  uint16_t pc;
+  uint16_t opcode;
+  uint8_t V[16];
+  uint16_t I;
+  uint8_t sp;
+  uint8_t delay_timer;
+  uint8_t sound_timer;
+  uint16_t input;
+};
+
+struct trace
+{
+  FILE* file;
+  uint64_t ring_chunks;
+
+  struct trace_chunk** slots;
+  uint32_t slot_count;
+  _Atomic uint64_t head;
+  _Atomic uint64_t tail;
+  atomic_int stop;
+  thrd_t writer;
+
+  atomic_int failed;
+
+  struct trace_chunk* chunk;
+  uint64_t input[2];
+  // Record the last event of the chunk was stored at.
+  uint32_t event_record;
+  int ticked;
+};
+
+// state is the state before record.index ran.
+struct trace_cursor
+{
+  struct chip8_state state;
+  uint32_t offset;
+  uint32_t remaining;
+  uint64_t event;
+  struct trace_record record;
+};
+
+// ring_instructions of 0 streams everything to disk, otherwise only about the
+// last ring_instructions records are kept and written when the trace is deleted.
+struct trace* new_trace(const char* path, uint64_t ring_instructions);
+// Returns -1 when the trace could not be written completely.
+int delete_trace(struct trace* trace);
+// Call after each chip8_timer_tick.
+void trace_tick(struct trace* trace);
+// The rare parts of trace_record.
+void trace_start_chunk(struct trace* trace, struct chip8_state* state);
+void trace_record_event(struct trace* trace, struct chip8_state* state);
+
+// Call before each chip8_cycle. It runs for every instruction, so the common
+// case is inline and only counts.
+static inline void trace_record(struct trace* trace, struct chip8_state* state)
+{
+  // One rarely taken branch covers both a full and a fresh chunk.
+  if ((uint32_t)(trace->chunk->count - 1) >= TRACE_CHUNK_RECORDS - 1)
+  {
+    trace_start_chunk(trace, state);
+  }
+
+  uint64_t input[2];
+  memcpy(input, state->input, sizeof(input));
+  if (((input[0] ^ trace->input[0]) | (input[1] ^ trace->input[1]) | trace->ticked) != 0)
+  {
+    trace_record_event(trace, state);
+  }
+
+  trace->chunk->count += 1;
+}
+
+int trace_read_header(FILE* file);
+int trace_read_chunk(FILE* file, struct trace_chunk* chunk);
+void trace_cursor_init(struct trace_cursor* cursor, struct trace_chunk* chunk);
+int trace_cursor_next(struct trace_cursor* cursor, struct trace_chunk* chunk);
+
+#endif
@@ -0,0 +1,345 @@
+#include "tracedb.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+
+static void list_append(struct tracedb_list* list, uint64_t value)
+{
+  if (list->count == list->capacity)
+  {
+    list->capacity = list->capacity == 0 ? 16 : list->capacity * 2;
+    list->items = realloc(list->items, list->capacity * sizeof(uint64_t));
+  }
+  list->items[list->count++] = value;
+}
+
+static int list_last_before(struct tracedb_list* list, uint64_t before, uint64_t* result)
+{
+  // Lists are appended in instruction order, so they are already sorted.
+  uint32_t low = 0;
+  uint32_t high = list->count;
+  while (low < high)
+  {
+    uint32_t mid = low + (high - low) / 2;
+    if (list->items[mid] < before)
+    {
+      low = mid + 1;
+    }
+    else
+    {
+      high = mid;
+    }
+  }
+
+  if (low == 0)
+  {
+    return 0;
+  }
+  *result = list->items[low - 1];
+  return 1;
+}
+
+static void index_changes(struct tracedb* db, struct trace_record* previous, struct trace_record* record)
+{
+  // Stored as the last instruction that ran before the new value was seen.
+  uint64_t index = record->index - 1;
+  for (int i = 0; i < 16; ++i)
+  {
+    if (record->V[i] != previous->V[i])
+    {
+      list_append(&db->changes[i], index);
+    }
+  }
+  if (record->I != previous->I)
+  {
+    list_append(&db->changes[TRACEDB_I], index);
+  }
+  if (record->sp != previous->sp)
+  {
+    list_append(&db->changes[TRACEDB_SP], index);
+  }
+  if (record->delay_timer != previous->delay_timer)
+  {
+    list_append(&db->changes[TRACEDB_DELAY_TIMER], index);
+  }
+  if (record->sound_timer != previous->sound_timer)
+  {
+    list_append(&db->changes[TRACEDB_SOUND_TIMER], index);
+  }
+  if (record->input != previous->input)
+  {
+    list_append(&db->changes[TRACEDB_INPUT], index);
+  }
+}
+
+static void index_writes(struct tracedb* db, struct chip8_state* state, struct trace_record* record)
+{
+  uint8_t x = (record->opcode & 0x0F00) >> 8;
+  switch (record->opcode & 0xF0FF)
+  {
+    // Fx33 LD B, Vx
+    case 0xF033:
+      for (int i = 0; i < 3; ++i)
+      {
+        list_append(&db->writes[(state->I + i) & 0x0FFF], record->index);
+      }
+      break;
+
+    // Fx55 LD [I], Vx
+    case 0xF055:
+      for (int i = 0; i <= x; ++i)
+      {
+        list_append(&db->writes[(state->I + i) & 0x0FFF], record->index);
+      }
+      break;
+  }
+}
+
+static void save_checkpoint(struct tracedb* db, struct tracedb_checkpoint* checkpoint, struct trace_cursor* cursor)
+{
+  checkpoint->offset = cursor->offset;
+  checkpoint->remaining = cursor->remaining;
+  checkpoint->event = cursor->event;
+  checkpoint->record = cursor->record;
+
+  const uint8_t* state = (const uint8_t*)&cursor->state;
+  const uint8_t* start = (const uint8_t*)&db->loaded->start;
+  memcpy(checkpoint->header, state, TRACEDB_HEADER_SIZE);
+  memset(checkpoint->changed, 0, sizeof(checkpoint->changed));
+  uint32_t count = 0;
+  for (uint32_t block = 0; block < TRACEDB_BLOCKS; ++block)
+  {
+    uint32_t offset = TRACEDB_HEADER_SIZE + block * TRACEDB_BLOCK_SIZE;
+    if (memcmp(&state[offset], &start[offset], TRACEDB_BLOCK_SIZE) != 0)
+    {
+      checkpoint->changed[block / 8] |= 1 << (block % 8);
+      count += 1;
+    }
+  }
+
+  checkpoint->blocks = count == 0 ? NULL : malloc(count * TRACEDB_BLOCK_SIZE);
+  uint8_t* out = checkpoint->blocks;
+  for (uint32_t block = 0; block < TRACEDB_BLOCKS; ++block)
+  {
+    if (checkpoint->changed[block / 8] >> (block % 8) & 1)
+    {
+      memcpy(out, &state[TRACEDB_HEADER_SIZE + block * TRACEDB_BLOCK_SIZE], TRACEDB_BLOCK_SIZE);
+      out += TRACEDB_BLOCK_SIZE;
+    }
+  }
+  db->checkpoint_bytes += sizeof(struct tracedb_checkpoint) + count * TRACEDB_BLOCK_SIZE;
+}
+
+// The checkpoint's chunk has to be loaded.
+static void restore_checkpoint(struct tracedb* db, struct tracedb_checkpoint* checkpoint, struct trace_cursor* cursor)
+{
+  chip8_restore(&cursor->state, &db->loaded->start);
+  uint8_t* state = (uint8_t*)&cursor->state;
+  memcpy(state, checkpoint->header, TRACEDB_HEADER_SIZE);
+  const uint8_t* in = checkpoint->blocks;
+  for (uint32_t block = 0; block < TRACEDB_BLOCKS; ++block)
+  {
+    if (checkpoint->changed[block / 8] >> (block % 8) & 1)
+    {
+      memcpy(&state[TRACEDB_HEADER_SIZE + block * TRACEDB_BLOCK_SIZE], in, TRACEDB_BLOCK_SIZE);
+      in += TRACEDB_BLOCK_SIZE;
+    }
+  }
+
+  cursor->offset = checkpoint->offset;
+  cursor->remaining = checkpoint->remaining;
+  cursor->event = checkpoint->event;
+  cursor->record = checkpoint->record;
+}
+
+static int load_chunk(struct tracedb* db, uint32_t chunk)
+{
+  if (db->loaded_chunk == chunk)
+  {
+    return 1;
+  }
+
+  db->loaded_chunk = UINT32_MAX;
+  if (fseek(db->file, db->chunks[chunk].offset, SEEK_SET) != 0 || !trace_read_chunk(db->file, db->loaded))
+  {
+    return 0;
+  }
+  db->loaded_chunk = chunk;
+  return 1;
+}
+
+struct tracedb* open_tracedb(const char* path, uint32_t interval)
+{
+  FILE* file = fopen(path, "rb");
+  if (file == NULL)
+  {
+    perror("Error");
+    return NULL;
+  }
+
+  if (trace_read_header(file) != 0)
+  {
+    printf("(ERROR) Not a trace or recorded by a different build: %s\n", path);
+    fclose(file);
+    return NULL;
+  }
+
+  struct tracedb* db = calloc(1, sizeof(struct tracedb));
+  db->file = file;
+  db->interval = interval == 0 ? TRACEDB_CHECKPOINT_INTERVAL : interval;
+  db->loaded = aligned_alloc(64, sizeof(struct trace_chunk));
+  db->loaded_chunk = UINT32_MAX;
+
+  // Replay every chunk once, the cursor executes the instructions again.
+  struct trace_cursor* cursor = aligned_alloc(64, sizeof(struct trace_cursor));
+  struct trace_record previous;
+  uint32_t chunk_capacity = 0;
+  uint32_t checkpoint_capacity = 0;
+  int first_record = 1;
+
+  while (1)
+  {
+    long offset = ftell(file);
+    if (!trace_read_chunk(file, db->loaded))
+    {
+      break;
+    }
+
+    if (db->chunk_count == chunk_capacity)
+    {
+      chunk_capacity = chunk_capacity == 0 ? 64 : chunk_capacity * 2;
+      db->chunks = realloc(db->chunks, chunk_capacity * sizeof(struct tracedb_chunk));
+    }
+    struct tracedb_chunk* chunk = &db->chunks[db->chunk_count];
+    chunk->first = db->loaded->first;
+    chunk->count = db->loaded->count;
+    chunk->offset = offset;
+
+    trace_cursor_init(cursor, db->loaded);
+    while (trace_cursor_next(cursor, db->loaded))
+    {
+      struct trace_record* record = &cursor->record;
+
+      if (!first_record)
+      {
+        index_changes(db, &previous, record);
+      }
+      previous = *record;
+      first_record = 0;
+
+      if ((record->index - chunk->first) % db->interval == 0)
+      {
+        if (db->checkpoint_count == checkpoint_capacity)
+        {
+          checkpoint_capacity = checkpoint_capacity == 0 ? 64 : checkpoint_capacity * 2;
+          db->checkpoints = realloc(db->checkpoints, checkpoint_capacity * sizeof(struct tracedb_checkpoint));
+        }
+        struct tracedb_checkpoint* checkpoint = &db->checkpoints[db->checkpoint_count++];
+        checkpoint->index = record->index;
+        checkpoint->chunk = db->chunk_count;
+        save_checkpoint(db, checkpoint, cursor);
+      }
+
+      index_writes(db, &cursor->state, record);
+    }
+
+    db->chunk_count += 1;
+  }
+
+  free(cursor);
+  return db;
+}
+
+void close_tracedb(struct tracedb* db)
+{
+  for (int i = 0; i < 4096; ++i)
+  {
+    free(db->writes[i].items);
+  }
+  for (int i = 0; i < TRACEDB_REGISTERS; ++i)
+  {
+    free(db->changes[i].items);
+  }
+  free(db->chunks);
+  for (uint32_t i = 0; i < db->checkpoint_count; ++i)
+  {
+    free(db->checkpoints[i].blocks);
+  }
+  free(db->checkpoints);
+  free(db->loaded);
+  fclose(db->file);
+  free(db);
+}
+
+uint64_t tracedb_first(struct tracedb* db)
+{
+  return db->chunk_count == 0 ? 0 : db->chunks[0].first;
+}
+
+uint64_t tracedb_end(struct tracedb* db)
+{
+  if (db->chunk_count == 0)
+  {
+    return 0;
+  }
+  struct tracedb_chunk* last = &db->chunks[db->chunk_count - 1];
+  return last->first + last->count;
+}
+
+int tracedb_last_write(struct tracedb* db, uint16_t address, uint64_t before, uint64_t* result)
+{
+  return list_last_before(&db->writes[address & 0x0FFF], before, result);
+}
+
+int tracedb_last_change(struct tracedb* db, int reg, uint64_t before, uint64_t* result)
+{
+  if (reg < 0 || reg >= TRACEDB_REGISTERS)
+  {
+    return 0;
+  }
+  return list_last_before(&db->changes[reg], before, result);
+}
+
+int tracedb_state_at(struct tracedb* db, uint64_t index, struct chip8_state* state)
+{
+  if (db->checkpoint_count == 0 || index < tracedb_first(db) || index >= tracedb_end(db))
+  {
+    return 0;
+  }
+
+  uint32_t low = 0;
+  uint32_t high = db->checkpoint_count;
+  while (high - low > 1)
+  {
+    uint32_t mid = low + (high - low) / 2;
+    if (db->checkpoints[mid].index <= index)
+    {
+      low = mid;
+    }
+    else
+    {
+      high = mid;
+    }
+  }
+
+  struct tracedb_checkpoint* checkpoint = &db->checkpoints[low];
+  if (!load_chunk(db, checkpoint->chunk))
+  {
+    return 0;
+  }
+
+  struct trace_cursor* cursor = aligned_alloc(64, sizeof(struct trace_cursor));
+  restore_checkpoint(db, checkpoint, cursor);
+  int found = 1;
+  while (found && cursor->record.index < index)
+  {
+    found = trace_cursor_next(cursor, db->loaded);
+  }
+  if (found)
+  {
+    chip8_restore(state, &cursor->state);
+  }
+  free(cursor);
+  return found;
+}
@@ -0,0 +1,88 @@
+#ifndef TRACEDB_H
+#define TRACEDB_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "chip8.h"
+#include "trace.h"
+
+#define TRACEDB_CHECKPOINT_INTERVAL 4096
+// Checkpoints keep everything before the display and the blocks of display
+// and memory that differ from the start of their chunk.
+#define TRACEDB_HEADER_SIZE offsetof(struct chip8_state, display)
+#define TRACEDB_BLOCK_SIZE 64
+#define TRACEDB_BLOCKS ((sizeof(struct chip8_state) - TRACEDB_HEADER_SIZE) / TRACEDB_BLOCK_SIZE)
+
+// Register indexes, V0 to VF come first.
+#define TRACEDB_I 16
+#define TRACEDB_SP 17
+#define TRACEDB_DELAY_TIMER 18
+#define TRACEDB_SOUND_TIMER 19
+#define TRACEDB_INPUT 20
+#define TRACEDB_REGISTERS 21
+
+struct tracedb_list
+{
+  uint64_t* items;
+  uint32_t count;
+  uint32_t capacity;
+};
+
+struct tracedb_chunk
+{
+  uint64_t first;
+  uint32_t count;
+  long offset;
+};
+
+// The cursor just past the record of instruction index, its state is the
+// one before that instruction ran. The state is stored as a delta against
+// the snapshot its chunk starts from, which is in the file anyway.
+struct tracedb_checkpoint
+{
+  uint64_t index;
+  uint32_t chunk;
+  uint32_t offset;
+  uint32_t remaining;
+  uint64_t event;
+  struct trace_record record;
+  uint8_t header[TRACEDB_HEADER_SIZE];
+  uint8_t changed[TRACEDB_BLOCKS / 8];
+  // The changed blocks in order.
+  uint8_t* blocks;
+};
+
+struct tracedb
+{
+  FILE* file;
+  uint32_t interval;
+
+  struct tracedb_chunk* chunks;
+  uint32_t chunk_count;
+  struct tracedb_checkpoint* checkpoints;
+  uint32_t checkpoint_count;
+  uint64_t checkpoint_bytes;
+
+  // Instructions that wrote each address, and records where each register changed.
+  struct tracedb_list writes[4096];
+  struct tracedb_list changes[TRACEDB_REGISTERS];
+
+  struct trace_chunk* loaded;
+  uint32_t loaded_chunk;
+};
+
+struct tracedb* open_tracedb(const char* path, uint32_t interval);
+void close_tracedb(struct tracedb* db);
+
+uint64_t tracedb_first(struct tracedb* db);
+uint64_t tracedb_end(struct tracedb* db);
+
+// Both return 0 when there is none, otherwise store the instruction index in result.
+int tracedb_last_write(struct tracedb* db, uint16_t address, uint64_t before, uint64_t* result);
+int tracedb_last_change(struct tracedb* db, int reg, uint64_t before, uint64_t* result);
+
+// Rebuilds the state as it was just before instruction index ran.
+int tracedb_state_at(struct tracedb* db, uint64_t index, struct chip8_state* state);
+
+#endif
@@ -0,0 +1,42 @@
+#include "triple_buffer.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+struct triple_buffer* new_triple_buffer()
+{
+  struct triple_buffer* buffer = aligned_alloc(64, sizeof(struct triple_buffer));
+  memset(buffer, 0, sizeof(struct triple_buffer));
+  buffer->back = 0;
+  atomic_init(&buffer->middle, 1);
+  buffer->front = 2;
+  return buffer;
+}
+
+void delete_triple_buffer(struct triple_buffer* buffer)
+{
+  free(buffer);
+}
+
+struct frame* triple_buffer_back(struct triple_buffer* buffer)
+{
+  return &buffer->frames[buffer->back];
+}
+
+void triple_buffer_publish(struct triple_buffer* buffer)
+{
+  unsigned int previous = atomic_exchange_explicit(&buffer->middle, buffer->back | TRIPLE_BUFFER_FRESH, memory_order_acq_rel);
+  buffer->back = previous & 3;
+}
+
+struct frame* triple_buffer_acquire(struct triple_buffer* buffer)
+{
+  if ((atomic_load_explicit(&buffer->middle, memory_order_relaxed) & TRIPLE_BUFFER_FRESH) == 0)
+  {
+    return NULL;
+  }
+
+  unsigned int previous = atomic_exchange_explicit(&buffer->middle, buffer->front, memory_order_acq_rel);
+  buffer->front = previous & 3;
+  return &buffer->frames[buffer->front];
+}
@@ -0,0 +1,51 @@
+#ifndef TRIPLE_BUFFER_H
+#define TRIPLE_BUFFER_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include "chip8.h"
+
+#define TRIPLE_BUFFER_FRESH 4
+
+struct frame
+{
+  _Alignas(64) uint8_t display[CHIP8_PACKED_DISPLAY_SIZE];
+  uint64_t number;
+  // Nanoseconds, TIME_UTC. input and observed are the oldest key event this
+  // frame is the first to show and the instruction that read it, 0 for none.
+  uint64_t published;
+  uint64_t input;
+  uint64_t observed;
+
+  // Registers of the real state at publish time and the instructions run so far.
+  uint16_t pc;
+  uint16_t I;
+  uint8_t sp;
+  uint8_t delay_timer;
+  uint8_t sound_timer;
+  uint8_t V[16];
+  uint64_t instructions;
+};
+
+// One writer and one reader, neither ever waits. The writer fills back and
+// swaps it with middle, the reader swaps front with middle when middle holds
+// a frame it has not seen, so it always gets the newest finished frame.
+struct triple_buffer
+{
+  struct frame frames[3];
+  _Alignas(64) _Atomic unsigned int middle;
+  _Alignas(64) unsigned int back;
+  _Alignas(64) unsigned int front;
+};
+
+struct triple_buffer* new_triple_buffer();
+void delete_triple_buffer(struct triple_buffer* buffer);
+
+// Writer side
+struct frame* triple_buffer_back(struct triple_buffer* buffer);
+void triple_buffer_publish(struct triple_buffer* buffer);
+
+// Reader side, NULL when nothing was published since the last call.
+struct frame* triple_buffer_acquire(struct triple_buffer* buffer);
+
+#endif
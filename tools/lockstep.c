@@ -0,0 +1,384 @@
+#include "chip8.h"
+#include "backend.h"
+#include "movie.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Runs two backends side by side on each ROM and stops at the first state
+// that differs between them. A built-in program that stores across the end
+// of memory runs first.
+// usage: lockstep [options] <rom>...
+//   -a <backend>, -b <backend>   engines to compare, interpreter and mirrored by default
+//   -g instruction|block|frame   how often states are compared, block by default
+//   -n <instructions>            instructions per ROM, 1000000 by default
+//   -s <seed>                    RNG seed for both sides
+//   -i <script>                  "<frame> <hex key mask>" lines, random presses otherwise
+
+#define GRANULARITY_INSTRUCTION 0
+#define GRANULARITY_BLOCK 1
+#define GRANULARITY_FRAME 2
+
+#define CONTEXT_SIZE 16
+
+struct input_change
+{
+  uint64_t frame;
+  uint16_t keys;
+};
+
+struct context
+{
+  uint16_t pc[CONTEXT_SIZE];
+  uint16_t opcode[CONTEXT_SIZE];
+  uint64_t count;
+};
+
+// I = 0xFFF, store V0 to V2 across the wrap, then loop.
+static const uint8_t wrap_program[] = { 0xAF, 0xFF, 0xF2, 0x55, 0x12, 0x04 };
+
+static const struct chip8_backend* backend_a;
+static const struct chip8_backend* backend_b;
+static int granularity = GRANULARITY_BLOCK;
+static uint64_t instructions = 1000000;
+static uint32_t seed = 1;
+static struct input_change* script = NULL;
+static int script_length = 0;
+
+static double now()
+{
+  struct timespec time;
+  timespec_get(&time, TIME_UTC);
+  return time.tv_sec + time.tv_nsec * 0.000000001;
+}
+
+static int load_script(char* path)
+{
+  FILE* file = fopen(path, "r");
+  if (file == NULL)
+  {
+    perror("Error");
+    return 0;
+  }
+
+  unsigned long long frame;
+  unsigned int keys;
+  int capacity = 0;
+  while (fscanf(file, "%llu %x", &frame, &keys) == 2)
+  {
+    if (script_length == capacity)
+    {
+      capacity = capacity == 0 ? 64 : capacity * 2;
+      script = realloc(script, capacity * sizeof(struct input_change));
+    }
+    script[script_length].frame = frame;
+    script[script_length].keys = keys;
+    script_length += 1;
+  }
+
+  fclose(file);
+  return 1;
+}
+
+static uint16_t keys_for_frame(uint64_t frame, uint32_t* random, uint16_t keys)
+{
+  if (script == NULL)
+  {
+    return scripted_keys(frame, random, keys);
+  }
+
+  for (int i = 0; i < script_length && script[i].frame <= frame; ++i)
+  {
+    keys = script[i].keys;
+  }
+  return keys;
+}
+
+static void remember(struct context* context, struct chip8_state* state)
+{
+  int slot = context->count % CONTEXT_SIZE;
+  context->pc[slot] = state->pc;
+  context->opcode[slot] = chip8_read(state, state->pc & 0x0FFF) << 8 | chip8_read(state, (state->pc + 1) & 0x0FFF);
+  context->count += 1;
+}
+
+// Prints format when print is set and the values differ, returns whether
+// they do.
+static int differs(int different, int print, const char* format, ...)
+{
+  if (different && print)
+  {
+    va_list args;
+    va_start(args, format);
+    vprintf(format, args);
+    va_end(args);
+  }
+  return different;
+}
+
+// Compares every field of the states that a backend may change, memory as
+// the program reads it, and returns how many differ. The same pass prints
+// them, so nothing is compared that the diff does not show.
+static int diff_states(struct chip8_state* a, struct chip8_state* b, int print)
+{
+  // Equal bytes are equal fields, the pass below only runs when a field,
+  // padding or where a page lives differs.
+  if (memcmp(a, b, sizeof(struct chip8_state)) == 0)
+  {
+    return 0;
+  }
+
+  int differing = 0;
+  differing += differs(a->pc != b->pc, print, "  PC: %03X != %03X\n", a->pc, b->pc);
+  differing += differs(a->I != b->I, print, "  I: %03X != %03X\n", a->I, b->I);
+  differing += differs(a->sp != b->sp, print, "  SP: %X != %X\n", a->sp, b->sp);
+  differing += differs(a->delay_timer != b->delay_timer, print, "  DT: %02X != %02X\n", a->delay_timer, b->delay_timer);
+  differing += differs(a->sound_timer != b->sound_timer, print, "  ST: %02X != %02X\n", a->sound_timer, b->sound_timer);
+  differing += differs(a->draw_flag != b->draw_flag, print, "  draw flag: %d != %d\n", a->draw_flag, b->draw_flag);
+  differing += differs(a->dirty_rows != b->dirty_rows, print, "  dirty rows: %08X != %08X\n", a->dirty_rows, b->dirty_rows);
+  differing += differs(a->rng != b->rng, print, "  RNG: %08X != %08X\n", a->rng, b->rng);
+  differing += differs(a->fault != b->fault, print, "  fault: %d != %d\n", a->fault, b->fault);
+  differing += differs(a->fault_pc != b->fault_pc, print, "  fault PC: %03X != %03X\n", a->fault_pc, b->fault_pc);
+  differing += differs(a->fault_opcode != b->fault_opcode, print, "  fault opcode: %04X != %04X\n", a->fault_opcode,
+    b->fault_opcode);
+  for (int i = 0; i < CHIP8_FAULT_COUNT - 1; ++i)
+  {
+    differing += differs(a->fault_counts[i] != b->fault_counts[i], print, "  fault_counts[%d]: %u != %u\n", i,
+      a->fault_counts[i], b->fault_counts[i]);
+  }
+
+  for (int i = 0; i < 16; ++i)
+  {
+    differing += differs(a->V[i] != b->V[i], print, "  V%X: %02X != %02X\n", i, a->V[i], b->V[i]);
+    differing += differs(a->stack[i] != b->stack[i], print, "  stack[%d]: %03X != %03X\n", i, a->stack[i], b->stack[i]);
+    differing += differs(a->input[i] != b->input[i], print, "  input[%X]: %d != %d\n", i, a->input[i], b->input[i]);
+    differing += differs(a->waiting_input[i] != b->waiting_input[i], print, "  waiting_input[%X]: %d != %d\n", i,
+      a->waiting_input[i], b->waiting_input[i]);
+  }
+
+  // Where a page lives is not compared, only what reads from it return.
+  int bytes = 0;
+  if (a->shared_pages != 0 || b->shared_pages != 0 || memcmp(a->memory, b->memory, sizeof(a->memory)) != 0)
+  {
+    for (int i = 0; i < 4096; ++i)
+    {
+      uint8_t byte_a = chip8_read(a, i);
+      uint8_t byte_b = chip8_read(b, i);
+      bytes += differs(byte_a != byte_b, print && bytes < 8, "  memory[%03X]: %02X != %02X\n", i, byte_a, byte_b);
+    }
+  }
+  differs(bytes > 8, print, "  ... %d memory bytes differ\n", bytes);
+  differing += bytes;
+
+  int pixels = 0;
+  if (memcmp(a->display, b->display, sizeof(a->display)) != 0)
+  {
+    for (int i = 0; i < CHIP8_SCREEN_WIDTH * CHIP8_SCREEN_HEIGHT; ++i)
+    {
+      pixels += differs(a->display[i] != b->display[i], print && pixels < 8, "  pixel (%d, %d): %d != %d\n",
+        i % CHIP8_SCREEN_WIDTH, i / CHIP8_SCREEN_WIDTH, a->display[i], b->display[i]);
+    }
+  }
+  differs(pixels > 8, print, "  ... %d pixels differ\n", pixels);
+  differing += pixels;
+  return differing;
+}
+
+static void report(struct context* context, uint64_t index, struct chip8_state* a, struct chip8_state* b)
+{
+  printf("  diverged after instruction %llu\n", (unsigned long long)index);
+  uint64_t first = context->count > CONTEXT_SIZE ? context->count - CONTEXT_SIZE : 0;
+  for (uint64_t i = first; i < context->count; ++i)
+  {
+    int slot = i % CONTEXT_SIZE;
+    printf("  %s %03X: %04X\n", i + 1 == context->count ? ">" : " ", context->pc[slot], context->opcode[slot]);
+  }
+  printf("  %s != %s\n", backend_a->name, backend_b->name);
+  diff_states(a, b, 1);
+}
+
+// path NULL runs wrap_program.
+static int check_rom(char* path)
+{
+  const char* name = path != NULL ? path : "(wrap)";
+  struct chip8_state* a = backend_a->new_state();
+  struct chip8_state* b = backend_b->new_state();
+  if (a == NULL || b == NULL)
+  {
+    printf("(ERROR) Backend %s is not available here\n", a == NULL ? backend_a->name : backend_b->name);
+    if (a != NULL)
+    {
+      backend_a->delete_state(a);
+    }
+    if (b != NULL)
+    {
+      backend_b->delete_state(b);
+    }
+    return 1;
+  }
+  struct chip8_state* checkpoint = aligned_alloc(64, sizeof(struct chip8_state));
+  if (path != NULL)
+  {
+    load_program(a, path);
+  }
+  else
+  {
+    memcpy(&a->memory[0x200], wrap_program, sizeof(wrap_program));
+  }
+  chip8_seed(a, seed);
+  chip8_snapshot(a, b);
+
+  struct context context = { 0 };
+  uint32_t random = seed ^ 0x9E3779B9;
+  uint16_t keys = 0;
+  uint64_t executed = 0;
+  int diverged = 0;
+  double start = now();
+
+  for (uint64_t frame = 0; executed < instructions && !diverged; ++frame)
+  {
+    keys = keys_for_frame(frame, &random, keys);
+    chip8_set_keys(a, keys);
+    chip8_set_keys(b, keys);
+    chip8_timer_tick(a);
+    chip8_timer_tick(b);
+
+    // Both sides are equal here, a divergence is located by stepping the
+    // frame again from this snapshot.
+    chip8_snapshot(a, checkpoint);
+    uint32_t remaining = CHIP8_CYCLES_PER_FRAME;
+    while (remaining > 0)
+    {
+      uint32_t count;
+      if (granularity == GRANULARITY_INSTRUCTION)
+      {
+        remember(&context, a);
+        count = backend_a->run(a, 1, 0);
+      }
+      else
+      {
+        count = backend_a->run(a, remaining, granularity == GRANULARITY_BLOCK);
+      }
+      backend_b->run(b, count, 0);
+      remaining -= count;
+
+      if (diff_states(a, b, 0) != 0)
+      {
+        uint64_t index = executed + CHIP8_CYCLES_PER_FRAME - remaining - 1;
+        if (granularity != GRANULARITY_INSTRUCTION)
+        {
+          struct chip8_state* first_a = aligned_alloc(64, sizeof(struct chip8_state));
+          struct chip8_state* first_b = aligned_alloc(64, sizeof(struct chip8_state));
+          chip8_snapshot(a, first_a);
+          chip8_snapshot(b, first_b);
+
+          chip8_restore(a, checkpoint);
+          chip8_restore(b, checkpoint);
+          uint64_t end = index + 1;
+          for (index = executed; index < end; ++index)
+          {
+            remember(&context, a);
+            backend_a->run(a, 1, 0);
+            backend_b->run(b, 1, 0);
+            if (diff_states(a, b, 0) != 0)
+            {
+              break;
+            }
+          }
+
+          // A backend with state outside chip8_state may not repeat itself.
+          if (index == end)
+          {
+            printf("  (could not narrow down, showing the compared states)\n");
+            index = end - 1;
+            chip8_restore(a, first_a);
+            chip8_restore(b, first_b);
+          }
+          free(first_a);
+          free(first_b);
+        }
+        printf("%s: frame %llu\n", name, (unsigned long long)frame);
+        report(&context, index, a, b);
+        diverged = 1;
+        break;
+      }
+    }
+    executed += CHIP8_CYCLES_PER_FRAME;
+  }
+
+  if (!diverged)
+  {
+    printf("%s: %llu instructions match (%.2f s)\n", name, (unsigned long long)executed, now() - start);
+  }
+
+  free(checkpoint);
+  backend_a->delete_state(a);
+  backend_b->delete_state(b);
+  return diverged;
+}
+
+int main(int argc, char* argv[])
+{
+  backend_a = find_backend("interpreter");
+  backend_b = find_backend("mirrored");
+
+  int i = 1;
+  for (; i < argc && argv[i][0] == '-'; ++i)
+  {
+    if (i + 1 >= argc)
+    {
+      break;
+    }
+    char* value = argv[++i];
+    switch (argv[i - 1][1])
+    {
+      case 'a':
+        backend_a = find_backend(value);
+        break;
+      case 'b':
+        backend_b = find_backend(value);
+        break;
+      case 'g':
+        granularity = strcmp(value, "instruction") == 0 ? GRANULARITY_INSTRUCTION
+          : strcmp(value, "frame") == 0 ? GRANULARITY_FRAME : GRANULARITY_BLOCK;
+        break;
+      case 'n':
+        instructions = strtoull(value, NULL, 10);
+        break;
+      case 's':
+        seed = strtoul(value, NULL, 0);
+        break;
+      case 'i':
+        if (!load_script(value))
+        {
+          return 1;
+        }
+        break;
+    }
+  }
+
+  if (i >= argc || backend_a == NULL || backend_b == NULL)
+  {
+    printf("usage: %s [-a backend] [-b backend] [-g instruction|block|frame] [-n instructions] [-s seed] [-i script] <rom>...\n", argv[0]);
+    printf("backends:");
+    for (int j = 0; j < chip8_backend_count; ++j)
+    {
+      printf(" %s", chip8_backends[j].name);
+    }
+    printf("\n");
+    return 1;
+  }
+
+  double start = now();
+  int failures = check_rom(NULL);
+  for (; i < argc; ++i)
+  {
+    failures += check_rom(argv[i]);
+  }
+  printf("%d ROM(s) diverged, %.2f s total\n", failures, now() - start);
+
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,151 @@
+#include "chip8.h"
+#include "mirror.h"
+#include "movie.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Runs each ROM with scripted keys through chip8_cycle, through
+// chip8_cycle_masked, which only wraps every address with a mask, and on a
+// mirrored state, which does not, checks that all three end in the same
+// state and compares the time. The masked and mirrored cycles differ only in
+// the masks, chip8_cycle also looks up shared pages.
+// Each ROM runs repetitions times, interleaved, and the fastest pass of each
+// counts. A built-in program that stores and draws across the end of memory
+// runs first.
+// usage: mirror_bench [-f frames] [-r repetitions] [-s seed] <rom>...
+
+// I = 0xFFA, store V0 to VF across the wrap, V0 += 1, draw 15 rows from I,
+// jump back to the store.
+static const uint8_t wrap_program[] = { 0xAF, 0xFA, 0xFF, 0x55, 0x70, 0x01, 0xD0, 0x1F, 0x12, 0x02 };
+
+static double now()
+{
+  struct timespec time;
+  timespec_get(&time, TIME_UTC);
+  return time.tv_sec + time.tv_nsec * 0.000000001;
+}
+
+static double run(struct chip8_state* state, void (*cycle)(struct chip8_state*), uint32_t frames, uint32_t seed)
+{
+  uint32_t random = seed ^ 0x9E3779B9;
+  uint16_t keys = 0;
+  double start = now();
+  for (uint32_t frame = 1; frame <= frames; ++frame)
+  {
+    keys = scripted_keys(frame, &random, keys);
+    chip8_set_keys(state, keys);
+    for (uint32_t i = 0; i < CHIP8_CYCLES_PER_FRAME; ++i)
+    {
+      cycle(state);
+    }
+    chip8_timer_tick(state);
+  }
+  return now() - start;
+}
+
+#define VARIANTS 3
+
+static const char* variant_names[VARIANTS] = { "checked", "masked", "mirrored" };
+static void (*const variant_cycles[VARIANTS])(struct chip8_state*) = { chip8_cycle, chip8_cycle_masked, chip8_cycle_mirrored };
+
+// Every pass starts from a copy of start, the mirrored ones in mirrored.
+static int compare(const char* name, struct chip8_state* start, struct chip8_state* scratch,
+  struct chip8_state* mirrored, uint32_t frames, uint32_t repetitions, uint32_t seed, double* totals)
+{
+  chip8_seed(start, seed);
+  double best[VARIANTS];
+  uint64_t hashes[VARIANTS];
+  for (int variant = 0; variant < VARIANTS; ++variant)
+  {
+    best[variant] = 1e9;
+  }
+
+  for (uint32_t repetition = 0; repetition < repetitions; ++repetition)
+  {
+    for (int variant = 0; variant < VARIANTS; ++variant)
+    {
+      struct chip8_state* state = variant_cycles[variant] == chip8_cycle_mirrored ? mirrored : scratch;
+      memcpy(state, start, sizeof(struct chip8_state));
+      double time = run(state, variant_cycles[variant], frames, seed);
+      best[variant] = time < best[variant] ? time : best[variant];
+      hashes[variant] = hash_state(state);
+    }
+  }
+
+  int same = hashes[0] == hashes[1] && hashes[0] == hashes[2];
+  double instructions = (double)frames * CHIP8_CYCLES_PER_FRAME;
+  printf("%-16s", name);
+  for (int variant = 0; variant < VARIANTS; ++variant)
+  {
+    totals[variant] += best[variant];
+    printf(" %s %6.1f", variant_names[variant], instructions / best[variant] / 1000000.0);
+  }
+  printf(" MIPS%s\n", same ? "" : "  STATES DIFFER");
+  return same;
+}
+
+int main(int argc, char* argv[])
+{
+  uint32_t frames = 20000;
+  uint32_t repetitions = 10;
+  uint32_t seed = 1;
+
+  int i = 1;
+  for (; i + 1 < argc && argv[i][0] == '-'; i += 2)
+  {
+    if (strcmp(argv[i], "-f") == 0)
+    {
+      frames = strtoul(argv[i + 1], NULL, 10);
+    }
+    else if (strcmp(argv[i], "-r") == 0)
+    {
+      repetitions = strtoul(argv[i + 1], NULL, 10);
+    }
+    else if (strcmp(argv[i], "-s") == 0)
+    {
+      seed = strtoul(argv[i + 1], NULL, 0);
+    }
+  }
+
+  if (i >= argc || repetitions == 0)
+  {
+    printf("usage: %s [-f frames] [-r repetitions] [-s seed] <rom>...\n", argv[0]);
+    return 1;
+  }
+
+  struct chip8_state* mirrored = new_chip8_mirrored();
+  if (mirrored == NULL)
+  {
+    printf("(ERROR) Mirrored memory is not available here\n");
+    return 1;
+  }
+  struct chip8_state* start = new_chip8();
+  struct chip8_state* scratch = new_chip8();
+
+  double totals[VARIANTS] = { 0.0, 0.0, 0.0 };
+  int failures = 0;
+
+  chip8_init(start);
+  memcpy(&start->memory[0x200], wrap_program, sizeof(wrap_program));
+  failures += !compare("(wrap)", start, scratch, mirrored, frames, repetitions, seed, totals);
+
+  totals[0] = totals[1] = totals[2] = 0.0;
+  for (; i < argc; ++i)
+  {
+    chip8_init(start);
+    load_program(start, argv[i]);
+    const char* slash = strrchr(argv[i], '/');
+    failures += !compare(slash != NULL ? slash + 1 : argv[i], start, scratch, mirrored, frames, repetitions, seed, totals);
+  }
+
+  printf("ROMs, fastest of %u: checked %.3f s, masked %.3f s, mirrored %.3f s, mirrored %+.1f%% throughput over masked\n",
+    repetitions, totals[0], totals[1], totals[2], (totals[1] / totals[2] - 1.0) * 100.0);
+
+  delete_chip8(start);
+  delete_chip8(scratch);
+  delete_chip8_mirrored(mirrored);
+  return failures == 0 ? 0 : 1;
+}
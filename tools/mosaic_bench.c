@@ -0,0 +1,100 @@
+#include "chip8.h"
+#include "renderer.h"
+#include "mosaic.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Runs many instances side by side and shows them as one mosaic, timing
+// emulation, tile uploads and drawing per frame. Configure with
+// -DGLFW_USE_OSMESA=ON to run it without a display.
+// usage: mosaic_bench [-n instances] [-f frames] <rom>...
+
+static double now()
+{
+  struct timespec time;
+  timespec_get(&time, TIME_UTC);
+  return time.tv_sec + time.tv_nsec * 0.000000001;
+}
+
+int main(int argc, char* argv[])
+{
+  uint32_t count = 256;
+  uint32_t frames = 600;
+
+  int i = 1;
+  for (; i + 1 < argc && argv[i][0] == '-'; i += 2)
+  {
+    if (strcmp(argv[i], "-n") == 0)
+    {
+      count = strtoul(argv[i + 1], NULL, 10);
+    }
+    else if (strcmp(argv[i], "-f") == 0)
+    {
+      frames = strtoul(argv[i + 1], NULL, 10);
+    }
+  }
+
+  if (i >= argc || count == 0)
+  {
+    printf("usage: %s [-n instances] [-f frames] <rom>...\n", argv[0]);
+    return 1;
+  }
+
+  init_renderer();
+  glfwSwapInterval(0);
+
+  // Instances cycle through the given ROMs, each with its own seed and a
+  // key held now and then so the games do not sit on their title screens.
+  int roms = argc - i;
+  struct chip8_state** states = malloc(count * sizeof(struct chip8_state*));
+  for (uint32_t j = 0; j < count; ++j)
+  {
+    states[j] = new_chip8();
+    load_program(states[j], argv[i + j % roms]);
+    chip8_seed(states[j], j + 1);
+  }
+  struct mosaic* mosaic = new_mosaic(count);
+
+  double emulation = 0.0;
+  double upload = 0.0;
+  double draw = 0.0;
+  double start = now();
+  for (uint32_t frame = 0; frame < frames && !should_close(); ++frame)
+  {
+    double begin = now();
+    for (uint32_t j = 0; j < count; ++j)
+    {
+      uint16_t keys = (frame / 30 + j) % 4 == 0 ? 1 << ((frame / 30 + j) % 16) : 0;
+      chip8_run_frames_through(states[j], keys, 1, CHIP8_CYCLES_PER_FRAME);
+    }
+    double emulated = now();
+    mosaic_update(mosaic, states);
+    double uploaded = now();
+    mosaic_draw(mosaic);
+    render_present();
+    poll_window();
+    double drawn = now();
+
+    emulation += emulated - begin;
+    upload += uploaded - emulated;
+    draw += drawn - uploaded;
+  }
+  double elapsed = now() - start;
+
+  printf("%u instances, %u frames in %.3f s (%.0f frames/s)\n", count, frames, elapsed, frames / elapsed);
+  printf("per frame: emulation %.3f ms, upload %.3f ms, draw %.3f ms\n",
+    emulation / frames * 1000.0, upload / frames * 1000.0, draw / frames * 1000.0);
+  printf("%.1f of %u tiles uploaded per frame in %.1f calls\n",
+    (double)mosaic->uploaded_tiles / frames, count, (double)mosaic->upload_calls / frames);
+
+  delete_mosaic(mosaic);
+  for (uint32_t j = 0; j < count; ++j)
+  {
+    delete_chip8(states[j]);
+  }
+  free(states);
+  return frames / elapsed >= 60.0 ? 0 : 2;
+}
@@ -0,0 +1,116 @@
+#include "chip8.h"
+#include "movie.h"
+#include "session.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Opens many sessions of one ROM, runs them without keys until they block
+// on Fx0A, parks the idle ones and reports the footprint. Then a minute
+// passes, in which only live sessions run, a key goes down in every session
+// and the first sessions are checked against copies that ran all along.
+// usage: park_bench [-n sessions] [-f frames] [-c checked] <rom>
+
+static double now()
+{
+  struct timespec time;
+  timespec_get(&time, TIME_UTC);
+  return time.tv_sec + time.tv_nsec * 0.000000001;
+}
+
+int main(int argc, char* argv[])
+{
+  uint32_t count = 100000;
+  uint32_t frames = 120;
+  uint32_t checked = 1000;
+
+  int i = 1;
+  for (; i + 1 < argc && argv[i][0] == '-'; i += 2)
+  {
+    if (strcmp(argv[i], "-n") == 0)
+    {
+      count = strtoul(argv[i + 1], NULL, 10);
+    }
+    else if (strcmp(argv[i], "-f") == 0)
+    {
+      frames = strtoul(argv[i + 1], NULL, 10);
+    }
+    else if (strcmp(argv[i], "-c") == 0)
+    {
+      checked = strtoul(argv[i + 1], NULL, 10);
+    }
+  }
+
+  if (i >= argc)
+  {
+    printf("usage: %s [-n sessions] [-f frames] [-c checked] <rom>\n", argv[0]);
+    return 1;
+  }
+  checked = checked < count ? checked : count;
+
+  struct chip8_state* reference = new_chip8();
+  load_program(reference, argv[i]);
+  struct session_manager* manager = new_session_manager(reference);
+  delete_chip8(reference);
+
+  struct chip8_state** controls = malloc(checked * sizeof(struct chip8_state*));
+  for (uint32_t id = 0; id < count; ++id)
+  {
+    session_open(manager, id + 1);
+    session_run(manager, id, 0, frames);
+    if (id < checked)
+    {
+      controls[id] = aligned_alloc(64, sizeof(struct chip8_state));
+      chip8_snapshot(session_state(manager, id), controls[id]);
+    }
+  }
+  uint64_t live_before = manager->footprint.live_bytes;
+
+  double start = now();
+  uint32_t parked = session_park_idle(manager);
+  double park_time = now() - start;
+
+  struct session_footprint* footprint = &manager->footprint;
+  printf("%u sessions after %u frames, %u parked (%.2f us each)\n", count, frames, parked,
+    parked > 0 ? park_time / parked * 1000000.0 : 0.0);
+  printf("live    %u, %.1f MB\n", footprint->live, footprint->live_bytes / 1048576.0);
+  printf("parked  %u, %.1f MB, %.0f bytes each\n", footprint->parked, footprint->parked_bytes / 1048576.0,
+    parked > 0 ? (double)footprint->parked_bytes / parked : 0.0);
+  printf("total   %.1f MB, was %.1f MB\n", (footprint->live_bytes + footprint->parked_bytes) / 1048576.0,
+    live_before / 1048576.0);
+
+  for (uint32_t id = 0; id < count; ++id)
+  {
+    if (manager->sessions[id].state != NULL)
+    {
+      session_run(manager, id, 0, 3600);
+    }
+  }
+
+  // Key 5 down for a few frames, then up.
+  start = now();
+  for (uint32_t id = 0; id < count; ++id)
+  {
+    session_run(manager, id, 1 << 5, 10);
+    session_run(manager, id, 0, 10);
+  }
+  double resume_time = now() - start;
+
+  uint32_t differ = 0;
+  for (uint32_t id = 0; id < checked; ++id)
+  {
+    chip8_run_frames_through(controls[id], 0, 3600, CHIP8_CYCLES_PER_FRAME);
+    chip8_run_frames_through(controls[id], 1 << 5, 10, CHIP8_CYCLES_PER_FRAME);
+    chip8_run_frames_through(controls[id], 0, 10, CHIP8_CYCLES_PER_FRAME);
+    differ += hash_state(controls[id]) != hash_state(session_state(manager, id));
+    free(controls[id]);
+  }
+  printf("resumed %u sessions in %.2f s, %u of %u checked differ from unparked runs\n", count, resume_time, differ,
+    checked);
+
+  free(controls);
+  delete_session_manager(manager);
+  return differ == 0 ? 0 : 1;
+}
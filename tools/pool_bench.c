@@ -0,0 +1,156 @@
+#include "chip8.h"
+#include "pool.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Runs many short-lived instances of one ROM, first made with new_chip8
+// and load_program each time, then taken from a pool whose template has
+// the ROM loaded, then from a second pool sharing the template's memory,
+// and compares the cost per run, the memory each state writes and what
+// each pool maps and keeps resident.
+// usage: pool_bench [-n runs] [-f frames] [-b batch] <rom>
+
+static double now()
+{
+  struct timespec time;
+  timespec_get(&time, TIME_UTC);
+  return time.tv_sec + time.tv_nsec * 0.000000001;
+}
+
+int main(int argc, char* argv[])
+{
+  uint32_t runs = 100000;
+  uint32_t frames = 1;
+  uint32_t batch = 256;
+
+  int i = 1;
+  for (; i + 1 < argc && argv[i][0] == '-'; i += 2)
+  {
+    if (strcmp(argv[i], "-n") == 0)
+    {
+      runs = strtoul(argv[i + 1], NULL, 10);
+    }
+    else if (strcmp(argv[i], "-f") == 0)
+    {
+      frames = strtoul(argv[i + 1], NULL, 10);
+    }
+    else if (strcmp(argv[i], "-b") == 0)
+    {
+      batch = strtoul(argv[i + 1], NULL, 10);
+    }
+  }
+
+  if (i >= argc || batch == 0)
+  {
+    printf("usage: %s [-n runs] [-f frames] [-b batch] <rom>\n", argv[0]);
+    return 1;
+  }
+
+  // Runs go in batches of instances alive at the same time, each with its
+  // own seed.
+  struct chip8_state** states = malloc(batch * sizeof(struct chip8_state*));
+  uint64_t check = 0;
+  double start = now();
+  for (uint32_t run = 0; run < runs; run += batch)
+  {
+    uint32_t count = runs - run < batch ? runs - run : batch;
+    for (uint32_t j = 0; j < count; ++j)
+    {
+      states[j] = new_chip8();
+      load_program(states[j], argv[i]);
+      chip8_seed(states[j], run + j + 1);
+      chip8_run_frames_through(states[j], 0, frames, CHIP8_CYCLES_PER_FRAME);
+      check += states[j]->pc;
+    }
+    for (uint32_t j = 0; j < count; ++j)
+    {
+      delete_chip8(states[j]);
+    }
+  }
+  double allocated = now() - start;
+
+  struct chip8_pool* pool = new_chip8_pool(batch);
+  if (pool == NULL)
+  {
+    return 1;
+  }
+  struct chip8_state* loaded = new_chip8();
+  load_program(loaded, argv[i]);
+  chip8_pool_set_template(pool, loaded);
+  delete_chip8(loaded);
+
+  uint64_t pool_check = 0;
+  start = now();
+  for (uint32_t run = 0; run < runs; run += batch)
+  {
+    uint32_t count = runs - run < batch ? runs - run : batch;
+    for (uint32_t j = 0; j < count; ++j)
+    {
+      states[j] = chip8_pool_acquire(pool);
+      chip8_seed(states[j], run + j + 1);
+      chip8_run_frames_through(states[j], 0, frames, CHIP8_CYCLES_PER_FRAME);
+      pool_check += states[j]->pc;
+    }
+    for (uint32_t j = 0; j < count; ++j)
+    {
+      chip8_pool_release(pool, states[j]);
+    }
+  }
+  double pooled = now() - start;
+
+  uint64_t pool_resident = chip8_pool_resident_bytes(pool);
+
+  struct chip8_pool* shared_pool = new_chip8_pool(batch);
+  if (shared_pool == NULL)
+  {
+    return 1;
+  }
+  chip8_pool_set_template(shared_pool, &pool->template);
+  chip8_pool_share_template(shared_pool);
+  uint64_t shared_check = 0;
+  uint64_t private_pages = 0;
+  start = now();
+  for (uint32_t run = 0; run < runs; run += batch)
+  {
+    uint32_t count = runs - run < batch ? runs - run : batch;
+    for (uint32_t j = 0; j < count; ++j)
+    {
+      states[j] = chip8_pool_acquire(shared_pool);
+      chip8_seed(states[j], run + j + 1);
+      chip8_run_frames_through(states[j], 0, frames, CHIP8_CYCLES_PER_FRAME);
+      shared_check += states[j]->pc;
+    }
+    if (run == 0)
+    {
+      private_pages = chip8_pool_private_pages(shared_pool);
+    }
+    for (uint32_t j = 0; j < count; ++j)
+    {
+      chip8_pool_release(shared_pool, states[j]);
+    }
+  }
+  double shared = now() - start;
+  uint64_t shared_resident = chip8_pool_resident_bytes(shared_pool);
+  uint32_t first = runs < batch ? runs : batch;
+
+  const char* pages[] = { "normal", "reserved huge", "transparent huge" };
+  printf("%u runs of %u frames, %u alive at once\n", runs, frames, batch);
+  printf("new_chip8  %.2f us per run\n", allocated / runs * 1000000.0);
+  printf("pool       %.2f us per run (%s pages)%s\n", pooled / runs * 1000000.0, pages[pool->huge_pages],
+    pool_check == check ? "" : ", RESULTS DIFFER");
+  printf("shared     %.2f us per run, %.0f of %zu memory bytes private per state%s\n", shared / runs * 1000000.0,
+    first > 0 ? (double)private_pages * CHIP8_PAGE_SIZE / first : 0.0, sizeof(pool->template.memory),
+    shared_check == check ? "" : ", RESULTS DIFFER");
+  // Slots are whole states either way, sharing only leaves memory untouched.
+  printf("footprint  %zu bytes per slot, pool %.1f MB mapped %.1f MB resident, shared %.1f MB mapped %.1f MB resident\n",
+    sizeof(struct chip8_state), pool->mapped_size / 1048576.0, pool_resident / 1048576.0,
+    shared_pool->mapped_size / 1048576.0, shared_resident / 1048576.0);
+
+  delete_chip8_pool(pool);
+  delete_chip8_pool(shared_pool);
+  free(states);
+  return pool_check == check && shared_check == check ? 0 : 1;
+}
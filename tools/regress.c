@@ -0,0 +1,261 @@
+#include "chip8.h"
+#include "fault.h"
+#include "movie.h"
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+#include <time.h>
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+// Runs every ROM headless with scripted keys and a fixed seed, hashes the
+// display after every frame into a running hash and compares it with golden
+// ones at a few frames, so each checkpoint covers every frame before it and
+// a blank screen at a checkpoint is no blind spot. ROMs are spread over all
+// cores.
+// usage: regress -g <file> [options] <rom>...
+//   -g <file>     golden hashes, "<rom> <frame> <hash>" lines, tools/golden.txt
+//                 in the source tree
+//   -u            write the hashes as the new golden file instead of checking
+//   -j <threads>  workers, one per core by default
+//   -s <seed>     RNG seed and key script seed
+
+#define CHECKPOINT_COUNT 5
+
+static const uint32_t checkpoints[CHECKPOINT_COUNT] = { 300, 900, 1800, 2700, 3600 };
+
+struct job
+{
+  const char* path;
+  const char* name;
+  uint64_t hashes[CHECKPOINT_COUNT];
+  // The first fault, kept running through like a real frontend would.
+  uint8_t fault;
+  uint16_t fault_pc;
+};
+
+struct golden
+{
+  char name[64];
+  uint32_t frame;
+  uint64_t hash;
+};
+
+static struct job* jobs;
+static int job_count;
+static _Atomic int next_job;
+static uint32_t seed = 1;
+
+static double now()
+{
+  struct timespec time;
+  timespec_get(&time, TIME_UTC);
+  return time.tv_sec + time.tv_nsec * 0.000000001;
+}
+
+static int work(void* argument)
+{
+  int index;
+  while ((index = atomic_fetch_add(&next_job, 1)) < job_count)
+  {
+    struct job* job = &jobs[index];
+    struct chip8_state* state = new_chip8();
+    load_program(state, (char*)job->path);
+    chip8_seed(state, seed);
+
+    uint32_t random = seed ^ 0x9E3779B9;
+    uint16_t keys = 0;
+    uint64_t running = 0;
+    int checkpoint = 0;
+    for (uint32_t frame = 1; checkpoint < CHECKPOINT_COUNT; ++frame)
+    {
+      keys = scripted_keys(frame, &random, keys);
+      if (chip8_run_frames_through(state, keys, 1, CHIP8_CYCLES_PER_FRAME) == CHIP8_EXIT_FAULT && job->fault == 0)
+      {
+        job->fault = state->fault;
+        job->fault_pc = state->fault_pc;
+      }
+      running = (running ^ hash_display(state)) * 0x100000001B3ull;
+      if (frame == checkpoints[checkpoint])
+      {
+        job->hashes[checkpoint++] = running;
+      }
+    }
+    delete_chip8(state);
+  }
+  return 0;
+}
+
+static int load_golden(const char* path, struct golden** golden)
+{
+  FILE* file = fopen(path, "r");
+  if (file == NULL)
+  {
+    perror("Error");
+    return -1;
+  }
+
+  int count = 0;
+  int capacity = 0;
+  struct golden entry;
+  unsigned long long hash;
+  while (fscanf(file, "%63s %u %llx", entry.name, &entry.frame, &hash) == 3)
+  {
+    if (count == capacity)
+    {
+      capacity = capacity == 0 ? 64 : capacity * 2;
+      *golden = realloc(*golden, capacity * sizeof(struct golden));
+    }
+    entry.hash = hash;
+    (*golden)[count++] = entry;
+  }
+
+  fclose(file);
+  return count;
+}
+
+static int cores()
+{
+#ifndef _WIN32
+  long count = sysconf(_SC_NPROCESSORS_ONLN);
+  return count > 0 ? count : 1;
+#else
+  return 4;
+#endif
+}
+
+int main(int argc, char* argv[])
+{
+  char* golden_path = NULL;
+  int update = 0;
+  int threads = cores();
+
+  int i = 1;
+  for (; i < argc && argv[i][0] == '-'; ++i)
+  {
+    if (strcmp(argv[i], "-u") == 0)
+    {
+      update = 1;
+      continue;
+    }
+    if (i + 1 >= argc)
+    {
+      break;
+    }
+    char* value = argv[++i];
+    switch (argv[i - 1][1])
+    {
+      case 'g':
+        golden_path = value;
+        break;
+      case 'j':
+        threads = atoi(value);
+        break;
+      case 's':
+        seed = strtoul(value, NULL, 0);
+        break;
+    }
+  }
+
+  if (i >= argc || threads < 1 || golden_path == NULL)
+  {
+    printf("usage: %s -g golden [-u] [-j threads] [-s seed] <rom>...\n", argv[0]);
+    return 1;
+  }
+
+  job_count = argc - i;
+  jobs = calloc(job_count, sizeof(struct job));
+  for (int j = 0; j < job_count; ++j)
+  {
+    jobs[j].path = argv[i + j];
+    const char* slash = strrchr(jobs[j].path, '/');
+    jobs[j].name = slash != NULL ? slash + 1 : jobs[j].path;
+  }
+
+  double start = now();
+  atomic_init(&next_job, 0);
+  thrd_t* workers = malloc(threads * sizeof(thrd_t));
+  for (int j = 0; j < threads; ++j)
+  {
+    thrd_create(&workers[j], work, NULL);
+  }
+  for (int j = 0; j < threads; ++j)
+  {
+    thrd_join(workers[j], NULL);
+  }
+  free(workers);
+  double elapsed = now() - start;
+
+  if (update)
+  {
+    FILE* file = fopen(golden_path, "w");
+    if (file == NULL)
+    {
+      perror("Error");
+      return 1;
+    }
+    for (int j = 0; j < job_count; ++j)
+    {
+      for (int k = 0; k < CHECKPOINT_COUNT; ++k)
+      {
+        fprintf(file, "%s %u %016llX\n", jobs[j].name, checkpoints[k], (unsigned long long)jobs[j].hashes[k]);
+      }
+    }
+    fclose(file);
+    printf("Wrote %d ROM(s) to %s (%.2f s, %d threads)\n", job_count, golden_path, elapsed, threads);
+    free(jobs);
+    return 0;
+  }
+
+  struct golden* golden = NULL;
+  int golden_count = load_golden(golden_path, &golden);
+  if (golden_count < 0)
+  {
+    free(jobs);
+    return 1;
+  }
+
+  int failures = 0;
+  for (int j = 0; j < job_count; ++j)
+  {
+    int failed = 0;
+    for (int k = 0; k < CHECKPOINT_COUNT && !failed; ++k)
+    {
+      const struct golden* expected = NULL;
+      for (int g = 0; g < golden_count && expected == NULL; ++g)
+      {
+        if (golden[g].frame == checkpoints[k] && strcmp(golden[g].name, jobs[j].name) == 0)
+        {
+          expected = &golden[g];
+        }
+      }
+
+      if (expected == NULL)
+      {
+        printf("%s: no golden hash for frame %u\n", jobs[j].name, checkpoints[k]);
+        failed = 1;
+      }
+      else if (expected->hash != jobs[j].hashes[k])
+      {
+        printf("%s: frame %u running display hash %016llX, golden %016llX\n", jobs[j].name, checkpoints[k],
+          (unsigned long long)jobs[j].hashes[k], (unsigned long long)expected->hash);
+        failed = 1;
+      }
+    }
+    failures += failed;
+    if (jobs[j].fault != CHIP8_FAULT_NONE)
+    {
+      printf("%s: %s at 0x%03X\n", jobs[j].name, chip8_fault_names[jobs[j].fault], jobs[j].fault_pc);
+    }
+  }
+  printf("%d of %d ROM(s) differ from %s (%.2f s, %d threads)\n", failures, job_count, golden_path, elapsed, threads);
+
+  free(golden);
+  free(jobs);
+  return failures == 0 ? 0 : 1;
+}
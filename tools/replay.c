@@ -0,0 +1,325 @@
+#include "chip8.h"
+#include "movie.h"
+#include "capture.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Plays a movie recorded with --record on a headless core as fast as
+// possible and checks the hashes stored in it. With a GIF path the first
+// playback is also captured, waiting on the encoder whenever it falls behind,
+// and the GIF is decoded again and compared with the displays it was given.
+// usage: replay <movie> <rom> [repeat] [capture.gif]
+
+#define CAPTURE_SCALE 4
+#define GIF_MAX_CODES 4096
+
+// Every display handed to the capture that differs from the one before,
+// which is what the GIF should show frame by frame.
+static uint8_t* captured;
+static uint32_t captured_count;
+
+static double now()
+{
+  struct timespec time;
+  timespec_get(&time, TIME_UTC);
+  return time.tv_sec + time.tv_nsec * 0.000000001;
+}
+
+// Returns the first frame whose hashes do not match, or the frame count.
+static uint32_t play(struct movie* movie, char* program_path, uint64_t* instructions, struct capture* capture)
+{
+  struct chip8_state* state = new_chip8();
+  load_program(state, program_path);
+  chip8_seed(state, movie->header.seed);
+
+  uint32_t frame = 0;
+  for (; frame < movie->header.frame_count; ++frame)
+  {
+    struct movie_frame* entry = &movie->frames[frame];
+    chip8_set_keys(state, entry->keys);
+    for (int i = 0; i < entry->cycles; ++i)
+    {
+      chip8_cycle(state);
+    }
+    chip8_timer_tick(state);
+    *instructions += entry->cycles;
+
+    if (capture != NULL)
+    {
+      uint8_t packed[CHIP8_PACKED_DISPLAY_SIZE];
+      chip8_pack_display(state, packed);
+      capture_frame(capture, packed, frame, 1);
+      uint8_t* slot = &captured[captured_count * CHIP8_PACKED_DISPLAY_SIZE];
+      if (captured_count == 0 || memcmp(packed, slot - CHIP8_PACKED_DISPLAY_SIZE, CHIP8_PACKED_DISPLAY_SIZE) != 0)
+      {
+        memcpy(slot, packed, CHIP8_PACKED_DISPLAY_SIZE);
+        captured_count += 1;
+      }
+    }
+
+    if (entry->flags & MOVIE_HASHED)
+    {
+      uint64_t display = hash_display(state);
+      uint64_t full = hash_state(state);
+      if (display != entry->display_hash || full != entry->state_hash)
+      {
+        printf("Frame %u: %s hash %016llX, recorded %016llX\n", frame,
+          display != entry->display_hash ? "display" : "state",
+          (unsigned long long)(display != entry->display_hash ? display : full),
+          (unsigned long long)(display != entry->display_hash ? entry->display_hash : entry->state_hash));
+        break;
+      }
+    }
+  }
+
+  delete_chip8(state);
+  return frame;
+}
+
+// The sub-blocks up to the terminator joined, NULL when the file ends first.
+static uint8_t* read_blocks(FILE* file, uint32_t* size)
+{
+  uint8_t* data = malloc(1);
+  *size = 0;
+  int length;
+  while ((length = fgetc(file)) > 0)
+  {
+    data = realloc(data, *size + length);
+    if (fread(&data[*size], 1, length, file) != (size_t)length)
+    {
+      break;
+    }
+    *size += length;
+  }
+  if (length != 0)
+  {
+    free(data);
+    return NULL;
+  }
+  return data;
+}
+
+// A strict LZW decoder: the code size grows once the next free code no
+// longer fits, like giflib and browsers do, and the data must end with the
+// end code at the width the decoder expects. Returns 0 on any error.
+static int decode_lzw(const uint8_t* data, uint32_t size, uint8_t* pixels, uint32_t count)
+{
+  static uint16_t prefix[GIF_MAX_CODES];
+  static uint8_t suffix[GIF_MAX_CODES];
+  static uint8_t string[GIF_MAX_CODES];
+  const uint32_t clear = 4;
+  const uint32_t end = 5;
+
+  uint32_t bit = 0;
+  uint32_t written = 0;
+  int code_size = 3;
+  uint32_t next = end + 1;
+  int32_t previous = -1;
+  for (uint32_t i = 0; i < clear; ++i)
+  {
+    prefix[i] = 0xFFFF;
+    suffix[i] = i;
+  }
+
+  for (;;)
+  {
+    if (bit + code_size > size * 8)
+    {
+      printf("(ERROR) The capture ran out of data before the end code\n");
+      return 0;
+    }
+    uint32_t code = 0;
+    for (int i = 0; i < code_size; ++i, ++bit)
+    {
+      code |= (data[bit / 8] >> (bit % 8) & 1u) << i;
+    }
+
+    if (code == clear)
+    {
+      code_size = 3;
+      next = end + 1;
+      previous = -1;
+      continue;
+    }
+    if (code == end)
+    {
+      if (written != count)
+      {
+        printf("(ERROR) The capture ends after %u of %u pixels\n", written, count);
+      }
+      return written == count;
+    }
+    if (code > next || (code == next && previous < 0))
+    {
+      printf("(ERROR) The capture holds code %u, only %u are defined\n", code, next);
+      return 0;
+    }
+
+    // code == next is the previous string plus its own first pixel.
+    uint32_t known = code < next ? code : (uint32_t)previous;
+    uint32_t length = 0;
+    for (uint32_t c = known; c != 0xFFFF; c = prefix[c])
+    {
+      string[length++] = suffix[c];
+    }
+    uint8_t first = string[length - 1];
+    if (written + length + (code == next) > count)
+    {
+      printf("(ERROR) The capture decodes to more pixels than the image has\n");
+      return 0;
+    }
+    for (uint32_t i = 0; i < length; ++i)
+    {
+      pixels[written++] = string[length - 1 - i];
+    }
+    if (code == next)
+    {
+      pixels[written++] = first;
+    }
+
+    if (previous >= 0 && next < GIF_MAX_CODES)
+    {
+      prefix[next] = previous;
+      suffix[next] = first;
+      next += 1;
+      if (next == 1u << code_size && code_size < 12)
+      {
+        code_size += 1;
+      }
+    }
+    previous = code;
+  }
+}
+
+// Decodes the GIF frame by frame onto a canvas and compares every frame
+// with the display it came from. Returns 1 when all of them match.
+static int check_capture(const char* path, uint32_t scale)
+{
+  FILE* file = fopen(path, "rb");
+  if (file == NULL)
+  {
+    perror("Error");
+    return 0;
+  }
+
+  uint32_t width = CHIP8_SCREEN_WIDTH * scale;
+  uint32_t height = CHIP8_SCREEN_HEIGHT * scale;
+  uint8_t* canvas = calloc(width * height, 1);
+  uint8_t* pixels = malloc(width * height);
+  uint8_t header[6 + 7 + 6];
+  uint32_t frame = 0;
+  int ok = fread(header, sizeof(header), 1, file) == 1 && memcmp(header, "GIF89a", 6) == 0;
+  int block;
+  while (ok && (block = fgetc(file)) != 0x3B)
+  {
+    uint32_t size;
+    uint8_t* data;
+    if (block == 0x21)
+    {
+      fgetc(file);
+      data = read_blocks(file, &size);
+      ok = data != NULL;
+      free(data);
+      continue;
+    }
+
+    uint8_t descriptor[9];
+    ok = block == 0x2C && fread(descriptor, sizeof(descriptor), 1, file) == 1 && fgetc(file) == 2;
+    data = ok ? read_blocks(file, &size) : NULL;
+    uint32_t left = descriptor[0] | descriptor[1] << 8;
+    uint32_t top = descriptor[2] | descriptor[3] << 8;
+    uint32_t w = descriptor[4] | descriptor[5] << 8;
+    uint32_t h = descriptor[6] | descriptor[7] << 8;
+    ok = data != NULL && left + w <= width && top + h <= height && decode_lzw(data, size, pixels, w * h);
+    free(data);
+    if (!ok)
+    {
+      break;
+    }
+
+    for (uint32_t y = 0; y < h; ++y)
+    {
+      memcpy(&canvas[(top + y) * width + left], &pixels[y * w], w);
+    }
+    const uint8_t* packed = &captured[frame * CHIP8_PACKED_DISPLAY_SIZE];
+    for (uint32_t i = 0; ok && i < width * height; ++i)
+    {
+      uint32_t x = i % width / scale;
+      uint32_t y = i / width / scale;
+      ok = frame < captured_count && canvas[i] == (packed[y * 8 + x / 8] >> (x % 8) & 1);
+    }
+    frame += ok;
+  }
+  ok = ok && frame == captured_count;
+  if (!ok)
+  {
+    printf("(ERROR) %s does not decode to the captured displays, frame %u differs\n", path, frame);
+  }
+
+  free(canvas);
+  free(pixels);
+  fclose(file);
+  return ok;
+}
+
+int main(int argc, char* argv[])
+{
+  if (argc < 3)
+  {
+    printf("usage: %s <movie> <rom> [repeat] [capture.gif]\n", argv[0]);
+    return 1;
+  }
+
+  struct movie* movie = open_movie(argv[1]);
+  if (movie == NULL)
+  {
+    return 1;
+  }
+
+  if (hash_file(argv[2]) != movie->header.rom_hash)
+  {
+    printf("(ERROR) %s is not the ROM this movie was recorded with\n", argv[2]);
+    close_movie(movie);
+    return 1;
+  }
+
+  int repeat = argc > 3 ? atoi(argv[3]) : 1;
+  struct capture* capture = argc > 4 ? new_capture(argv[4], CAPTURE_SCALE) : NULL;
+  captured = malloc((size_t)movie->header.frame_count * CHIP8_PACKED_DISPLAY_SIZE);
+  uint64_t instructions = 0;
+  int result = 0;
+  double start = now();
+  for (int i = 0; i < repeat && result == 0; ++i)
+  {
+    if (play(movie, argv[2], &instructions, i == 0 ? capture : NULL) != movie->header.frame_count)
+    {
+      result = 2;
+    }
+  }
+  if (capture != NULL)
+  {
+    finish_capture(capture, movie->header.frame_count);
+  }
+  double elapsed = now() - start;
+
+  printf("%u frames x %d, %llu instructions in %.3f s (%.0f frames/s, %.1f MIPS)%s\n",
+    movie->header.frame_count, repeat, (unsigned long long)instructions, elapsed,
+    movie->header.frame_count * (double)repeat / elapsed, instructions / elapsed / 1000000.0,
+    result == 0 ? ", all hashes match" : "");
+  if (capture != NULL)
+  {
+    printf("Captured %llu frames, %llu bytes\n", (unsigned long long)capture->frames, (unsigned long long)capture->bytes);
+    delete_capture(capture);
+    if (result == 0 && !check_capture(argv[4], CAPTURE_SCALE))
+    {
+      result = 3;
+    }
+  }
+  free(captured);
+
+  close_movie(movie);
+  return result;
+}
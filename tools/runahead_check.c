@@ -0,0 +1,150 @@
+#include "chip8.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Measures how many frames it takes for a key press to show on screen, with
+// run-ahead from 0 up to the given number of frames. For every key the game
+// reacts to, the shown display of a run holding the key is compared with one
+// holding nothing, starting from the same state.
+// usage: runahead_check [-n frames] [-w warmup] [-s samples] <rom>...
+
+#define MAX_LAG 60
+#define SAMPLE_STRIDE 7
+
+static double now()
+{
+  struct timespec time;
+  timespec_get(&time, TIME_UTC);
+  return time.tv_sec + time.tv_nsec * 0.000000001;
+}
+
+// Advances real by one frame with keys held, then returns the display that
+// run-ahead would show for it.
+static uint8_t* step(struct chip8_state* real, struct chip8_state* ahead, uint16_t keys, uint32_t run_ahead)
+{
+  chip8_run_frames_through(real, keys, 1, CHIP8_CYCLES_PER_FRAME);
+  if (run_ahead == 0)
+  {
+    return real->display;
+  }
+  chip8_snapshot(real, ahead);
+  chip8_run_frames_through(ahead, keys, run_ahead, CHIP8_CYCLES_PER_FRAME);
+  return ahead->display;
+}
+
+// Frames until pressing key makes the shown display differ, -1 if it never does.
+static int visible_lag(struct chip8_state* start, int key, uint32_t run_ahead, struct chip8_state** scratch)
+{
+  chip8_snapshot(start, scratch[0]);
+  chip8_snapshot(start, scratch[1]);
+  for (int frame = 0; frame < MAX_LAG; ++frame)
+  {
+    uint8_t* idle = step(scratch[0], scratch[2], 0, run_ahead);
+    uint8_t* pressed = step(scratch[1], scratch[3], 1 << key, run_ahead);
+    if (memcmp(idle, pressed, CHIP8_SCREEN_WIDTH * CHIP8_SCREEN_HEIGHT) != 0)
+    {
+      return frame;
+    }
+  }
+  return -1;
+}
+
+static int compare_ints(const void* a, const void* b)
+{
+  return *(const int*)a - *(const int*)b;
+}
+
+// Games ignore input in some states, so presses are tried from a number of
+// start points spread over the game and summarized by the median.
+static void check_rom(char* path, uint32_t max_run_ahead, uint32_t warmup, uint32_t samples)
+{
+  struct chip8_state* start = new_chip8();
+  struct chip8_state* scratch[4];
+  for (int i = 0; i < 4; ++i)
+  {
+    scratch[i] = aligned_alloc(64, sizeof(struct chip8_state));
+  }
+  load_program(start, path);
+  chip8_seed(start, 1);
+  chip8_run_frames_through(start, 0, warmup, CHIP8_CYCLES_PER_FRAME);
+
+  int* lags = malloc(samples * 16 * (max_run_ahead + 1) * sizeof(int));
+  int count = 0;
+  double begin = now();
+  for (uint32_t sample = 0; sample < samples; ++sample)
+  {
+    for (int key = 0; key < 16; ++key)
+    {
+      if (visible_lag(start, key, 0, scratch) < 0)
+      {
+        continue;
+      }
+      for (uint32_t run_ahead = 0; run_ahead <= max_run_ahead; ++run_ahead)
+      {
+        int lag = visible_lag(start, key, run_ahead, scratch);
+        lags[run_ahead * samples * 16 + count] = lag < 0 ? MAX_LAG : lag;
+      }
+      count += 1;
+    }
+    chip8_run_frames_through(start, 0, SAMPLE_STRIDE, CHIP8_CYCLES_PER_FRAME);
+  }
+
+  printf("%s: %d presses (%.0f ms)\n", path, count, (now() - begin) * 1000.0);
+  for (uint32_t run_ahead = 0; run_ahead <= max_run_ahead && count > 0; ++run_ahead)
+  {
+    int* lag = &lags[run_ahead * samples * 16];
+    qsort(lag, count, sizeof(int), compare_ints);
+    int zero = 0;
+    while (zero < count && lag[zero] == 0)
+    {
+      zero += 1;
+    }
+    printf("  run-ahead %u: median %d frames, %.0f%% shown on the next frame\n", run_ahead, lag[count / 2], zero * 100.0 / count);
+  }
+
+  free(lags);
+  for (int i = 0; i < 4; ++i)
+  {
+    free(scratch[i]);
+  }
+  delete_chip8(start);
+}
+
+int main(int argc, char* argv[])
+{
+  uint32_t max_run_ahead = 3;
+  uint32_t warmup = 120;
+  uint32_t samples = 32;
+
+  int i = 1;
+  for (; i + 1 < argc && argv[i][0] == '-'; i += 2)
+  {
+    if (strcmp(argv[i], "-n") == 0)
+    {
+      max_run_ahead = strtoul(argv[i + 1], NULL, 10);
+    }
+    else if (strcmp(argv[i], "-w") == 0)
+    {
+      warmup = strtoul(argv[i + 1], NULL, 10);
+    }
+    else if (strcmp(argv[i], "-s") == 0)
+    {
+      samples = strtoul(argv[i + 1], NULL, 10);
+    }
+  }
+
+  if (i >= argc)
+  {
+    printf("usage: %s [-n frames] [-w warmup] [-s samples] <rom>...\n", argv[0]);
+    return 1;
+  }
+
+  for (; i < argc; ++i)
+  {
+    check_rom(argv[i], max_run_ahead, warmup, samples);
+  }
+  return 0;
+}
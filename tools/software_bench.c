@@ -0,0 +1,127 @@
+#include "chip8.h"
+#include "software.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Times the software renderer with every kernel the CPU has: redrawing all
+// rows each frame, and presenting a running ROM where only changed rows are
+// redrawn. Scale 30 is the largest that fits 1080p.
+// A full redraw at that size writes 7.4 MB, more than most caches hold, so
+// its frame rate follows the memory bandwidth of the machine rather than
+// the kernel, and scalar and vector kernels end up close. There is no fixed
+// pass mark: -t sets a target for the fastest kernel's full redraws and
+// makes the exit status 2 when it is missed.
+// usage: software_bench [-s scale] [-f frames] [-t fps] [-o out.ppm] <rom>
+
+static double now()
+{
+  struct timespec time;
+  timespec_get(&time, TIME_UTC);
+  return time.tv_sec + time.tv_nsec * 0.000000001;
+}
+
+int main(int argc, char* argv[])
+{
+  uint32_t scale = 30;
+  uint32_t frames = 3000;
+  double target = 0.0;
+  char* ppm_path = NULL;
+
+  int i = 1;
+  for (; i + 1 < argc && argv[i][0] == '-'; i += 2)
+  {
+    if (strcmp(argv[i], "-s") == 0)
+    {
+      scale = strtoul(argv[i + 1], NULL, 10);
+    }
+    else if (strcmp(argv[i], "-f") == 0)
+    {
+      frames = strtoul(argv[i + 1], NULL, 10);
+    }
+    else if (strcmp(argv[i], "-t") == 0)
+    {
+      target = strtod(argv[i + 1], NULL);
+    }
+    else if (strcmp(argv[i], "-o") == 0)
+    {
+      ppm_path = argv[i + 1];
+    }
+  }
+
+  if (i >= argc || scale == 0 || frames == 0)
+  {
+    printf("usage: %s [-s scale] [-f frames] [-t fps] [-o out.ppm] <rom>\n", argv[0]);
+    return 1;
+  }
+
+  // The displays of the first frames of the ROM, replayed for every kernel.
+  uint8_t* displays = malloc((uint64_t)frames * CHIP8_PACKED_DISPLAY_SIZE);
+  struct chip8_state* state = new_chip8();
+  load_program(state, argv[i]);
+  chip8_seed(state, 1);
+  for (uint32_t frame = 0; frame < frames; ++frame)
+  {
+    uint16_t keys = frame / 30 % 4 == 0 ? 1 << (frame / 30 % 16) : 0;
+    chip8_run_frames_through(state, keys, 1, CHIP8_CYCLES_PER_FRAME);
+    chip8_pack_display(state, &displays[(uint64_t)frame * CHIP8_PACKED_DISPLAY_SIZE]);
+  }
+  delete_chip8(state);
+
+  struct software_renderer* renderer = new_software_renderer(scale, NULL);
+  printf("%ux%u RGBA, %u frames of %s\n", renderer->width, renderer->height, frames, argv[i]);
+  double megabytes = (double)renderer->width * renderer->height * 4 / 1000000.0;
+
+  double default_fps = 0.0;
+  for (int k = 0; k < software_kernel_count; ++k)
+  {
+    const struct software_kernel* kernel = &software_kernels[k];
+    if (!kernel->supported())
+    {
+      continue;
+    }
+    renderer->kernel = kernel;
+
+    double start = now();
+    for (uint32_t frame = 0; frame < frames; ++frame)
+    {
+      software_render_rows(renderer, &displays[(uint64_t)frame * CHIP8_PACKED_DISPLAY_SIZE], 0xFFFFFFFF);
+    }
+    double full = now() - start;
+
+    memset(renderer->shown, 0, CHIP8_PACKED_DISPLAY_SIZE);
+    software_render_rows(renderer, renderer->shown, 0xFFFFFFFF);
+    uint64_t rows_before = renderer->rows_drawn;
+    uint64_t presented = 0;
+    start = now();
+    for (uint32_t frame = 0; frame < frames; ++frame)
+    {
+      presented += software_render_frame(renderer, &displays[(uint64_t)frame * CHIP8_PACKED_DISPLAY_SIZE]) != 0;
+    }
+    double dirty = now() - start;
+
+    printf("%-6s full %8.0f fps (%5.1f GB/s), changed rows only %8.0f fps, %llu of %u frames changed, %.1f rows each\n",
+      kernel->name, frames / full, frames * megabytes / full / 1000.0, frames / dirty,
+      (unsigned long long)presented, frames, presented != 0 ? (double)(renderer->rows_drawn - rows_before) / presented : 0.0);
+    if (default_fps == 0.0)
+    {
+      default_fps = frames / full;
+    }
+  }
+
+  if (ppm_path != NULL)
+  {
+    software_write_ppm(renderer, ppm_path);
+  }
+
+  delete_software_renderer(renderer);
+  free(displays);
+  if (target > 0.0 && default_fps < target)
+  {
+    printf("Full redraws at %.0f fps miss the target of %.0f fps\n", default_fps, target);
+    return 2;
+  }
+  return 0;
+}
@@ -0,0 +1,82 @@
+#include "chip8.h"
+#include "trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Compares interpreter throughput with and without the trace recorder.
+// usage: trace_bench <rom> [instructions] [trace path] [ring instructions]
+
+static double now()
+{
+  struct timespec time;
+  timespec_get(&time, TIME_UTC);
+  return time.tv_sec + time.tv_nsec * 0.000000001;
+}
+
+static double run(char* program_path, uint64_t instructions, struct trace* trace)
+{
+  struct chip8_state* state = new_chip8();
+  load_program(state, program_path);
+
+  double start = now();
+  for (uint64_t i = 0; i < instructions; ++i)
+  {
+    if (trace != NULL)
+    {
+      trace_record(trace, state);
+    }
+    chip8_cycle(state);
+  }
+  double elapsed = now() - start;
+
+  delete_chip8(state);
+  return instructions / elapsed / 1000000.0;
+}
+
+int main(int argc, char* argv[])
+{
+  if (argc < 2)
+  {
+    printf("usage: %s <rom> [instructions] [trace path] [ring instructions]\n", argv[0]);
+    return 1;
+  }
+
+  uint64_t instructions = argc > 2 ? strtoull(argv[2], NULL, 10) : 50000000;
+  char* trace_path = argc > 3 ? argv[3] : "trace_bench.c8tr";
+  uint64_t ring = argc > 4 ? strtoull(argv[4], NULL, 10) : 0;
+
+  // Best of three, a shared core is noisy.
+  double untraced = 0.0;
+  double traced = 0.0;
+  double total = 0.0;
+  for (int i = 0; i < 3; ++i)
+  {
+    double mips = run(argv[1], instructions, NULL);
+    untraced = mips > untraced ? mips : untraced;
+
+    struct trace* trace = new_trace(trace_path, ring);
+    if (trace == NULL)
+    {
+      return 1;
+    }
+    double start = now();
+    mips = run(argv[1], instructions, trace);
+    if (delete_trace(trace) != 0)
+    {
+      return 1;
+    }
+    if (mips > traced)
+    {
+      traced = mips;
+      total = now() - start;
+    }
+  }
+
+  printf("untraced: %.1f MIPS\n", untraced);
+  printf("traced:   %.1f MIPS (%.0f%%), %.2fs including final flush\n", traced, traced / untraced * 100.0, total);
+
+  return traced * 2 >= untraced ? 0 : 2;
+}
@@ -0,0 +1,141 @@
+#include "chip8.h"
+#include "tracedb.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+// Indexes a trace recorded with --trace and answers queries read from stdin:
+//   write <address> <N>    last instruction before N that wrote memory[address]
+//   change <register> <N>  last instruction before N after which V0-VF, I, SP, DT, ST or KEYS changed
+//   state <N>              registers, stack and timers just before instruction N
+// Numbers accept a 0x prefix.
+
+static double now()
+{
+  struct timespec time;
+  timespec_get(&time, TIME_UTC);
+  return time.tv_sec + time.tv_nsec * 0.000000001;
+}
+
+static int parse_register(char* name)
+{
+  if ((name[0] == 'V' || name[0] == 'v') && name[1] != '\0' && name[2] == '\0')
+  {
+    char* end;
+    long reg = strtol(name + 1, &end, 16);
+    return *end == '\0' ? reg : -1;
+  }
+
+  char* names[] = { "I", "SP", "DT", "ST", "KEYS" };
+  for (int i = 0; i < 5; ++i)
+  {
+    if (strcasecmp(name, names[i]) == 0)
+    {
+      return TRACEDB_I + i;
+    }
+  }
+  return -1;
+}
+
+static void print_state(struct chip8_state* state)
+{
+  printf("PC: %03X I: %03X SP: %X DT: %02X ST: %02X\n", state->pc, state->I, state->sp, state->delay_timer, state->sound_timer);
+  for (int i = 0; i < 16; ++i)
+  {
+    printf("V%X: %02X%s", i, state->V[i], i % 8 == 7 ? "\n" : " ");
+  }
+  printf("Stack:");
+  for (int i = 0; i < state->sp && i < 16; ++i)
+  {
+    printf(" %03X", state->stack[i]);
+  }
+  printf("\n");
+}
+
+int main(int argc, char* argv[])
+{
+  if (argc < 2)
+  {
+    printf("usage: %s <trace> [checkpoint interval]\n", argv[0]);
+    return 1;
+  }
+
+  double start = now();
+  struct tracedb* db = open_tracedb(argv[1], argc > 2 ? strtoul(argv[2], NULL, 0) : 0);
+  if (db == NULL)
+  {
+    return 1;
+  }
+  printf("Indexed instructions %llu to %llu with %u checkpoints (%.1f MB) in %.0f ms\n",
+    (unsigned long long)tracedb_first(db), (unsigned long long)tracedb_end(db),
+    db->checkpoint_count, db->checkpoint_bytes / 1048576.0, (now() - start) * 1000.0);
+
+  struct chip8_state* state = aligned_alloc(64, sizeof(struct chip8_state));
+  char line[256];
+  while (fgets(line, sizeof(line), stdin) != NULL)
+  {
+    char command[16];
+    char argument[16];
+    unsigned long long index;
+    uint64_t result;
+    start = now();
+
+    if (sscanf(line, "write %15s %lli", argument, &index) == 2)
+    {
+      uint16_t address = strtoul(argument, NULL, 0);
+      if (tracedb_last_write(db, address, index, &result))
+      {
+        printf("memory[%03X] last written by instruction %llu", address, (unsigned long long)result);
+      }
+      else
+      {
+        printf("memory[%03X] not written before %llu", address, index);
+      }
+    }
+    else if (sscanf(line, "change %15s %lli", argument, &index) == 2)
+    {
+      int reg = parse_register(argument);
+      if (reg < 0)
+      {
+        printf("(ERROR) Unknown register: %s\n", argument);
+        continue;
+      }
+      if (tracedb_last_change(db, reg, index, &result))
+      {
+        printf("%s last changed after instruction %llu", argument, (unsigned long long)result);
+      }
+      else
+      {
+        printf("%s unchanged before %llu", argument, index);
+      }
+    }
+    else if (sscanf(line, "state %lli", &index) == 1)
+    {
+      if (!tracedb_state_at(db, index, state))
+      {
+        printf("(ERROR) Instruction %llu is not in the trace\n", index);
+        continue;
+      }
+      print_state(state);
+      printf("reconstructed");
+    }
+    else if (sscanf(line, "%15s", command) == 1 && strcmp(command, "quit") == 0)
+    {
+      break;
+    }
+    else
+    {
+      printf("(ERROR) Unknown query: %s", line);
+      continue;
+    }
+
+    printf(" (%.3f ms)\n", (now() - start) * 1000.0);
+  }
+
+  free(state);
+  close_tracedb(db);
+  return 0;
+}
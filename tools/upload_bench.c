@@ -0,0 +1,91 @@
+#include "chip8.h"
+#include "renderer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// Times render_display with synchronous texture uploads and with the pixel
+// buffer ring. Frames whose pixels did not change are neither uploaded nor
+// presented, so only the ones that were count. Configure with -DGLFW_USE_OSMESA=ON to run it without a display.
+// usage: upload_bench <rom> [frames]
+
+static double now()
+{
+  struct timespec time;
+  timespec_get(&time, TIME_UTC);
+  return time.tv_sec + time.tv_nsec * 0.000000001;
+}
+
+static int compare_doubles(const void* a, const void* b)
+{
+  double x = *(const double*)a;
+  double y = *(const double*)b;
+  return (x > y) - (x < y);
+}
+
+// Returns how many of the frames were drawn, their times are in times.
+static int run(char* program_path, int frames, int use_pbo, double* times)
+{
+  struct chip8_state* state = new_chip8();
+  load_program(state, program_path);
+  chip8_seed(state, 1);
+  render_use_pbo(use_pbo);
+
+  int drawn = 0;
+  for (int frame = 0; frame < frames; ++frame)
+  {
+    for (int i = 0; i < CHIP8_CYCLES_PER_FRAME; ++i)
+    {
+      chip8_cycle(state);
+    }
+    chip8_timer_tick(state);
+
+    double start = now();
+    if (render_display(state))
+    {
+      times[drawn++] = now() - start;
+    }
+  }
+
+  delete_chip8(state);
+  return drawn;
+}
+
+static void report(const char* name, double* times, int frames)
+{
+  if (frames == 0)
+  {
+    printf("%-6s no frame changed the display\n", name);
+    return;
+  }
+  double total = 0.0;
+  for (int i = 0; i < frames; ++i)
+  {
+    total += times[i];
+  }
+  qsort(times, frames, sizeof(double), compare_doubles);
+  printf("%-6s %d frames, mean %.1f us, p99 %.1f us, max %.1f us\n", name, frames,
+    total / frames * 1000000.0, times[frames * 99 / 100] * 1000000.0, times[frames - 1] * 1000000.0);
+}
+
+int main(int argc, char* argv[])
+{
+  if (argc < 2)
+  {
+    printf("usage: %s <rom> [frames]\n", argv[0]);
+    return 1;
+  }
+
+  int frames = argc > 2 ? atoi(argv[2]) : 5000;
+  double* times = malloc(frames * sizeof(double));
+
+  init_renderer();
+  glfwSwapInterval(0);
+
+  report("sync", times, run(argv[1], frames, 0, times));
+  report("pbo", times, run(argv[1], frames, 1, times));
+
+  free(times);
+  return 0;
+}